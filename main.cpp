@@ -21,18 +21,20 @@
  
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <string>
-#include <unordered_map>
-#include <random>
+#include <string_view>
 #include <chrono>
+#include <atomic>
 #include <thread>
-#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <time.h>
 #include <cctype>
 #include <cstdlib>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <signal.h>
-#include <sstream>
 #include <algorithm>
 #include <sys/stat.h>
 #include <errno.h>
@@ -41,10 +43,51 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#endif
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// Append-only arena for lines kept the whole run (-t texts).
+struct line_ref { uint32_t block; uint32_t offset; uint32_t len; };
+
+struct line_store {
+	static constexpr size_t LINE_BLOCK_MIN = 4096;
+	static constexpr size_t LINE_BLOCK_MAX = 1 << 20;
+	vector<unique_ptr<char[]>> blocks;
+	vector<line_ref> index;
+	size_t block_used = 0;
+	size_t block_cap = 0;
+
+	void push_back(string_view line){
+		if(blocks.empty() || block_cap - block_used < line.size()){
+			size_t cap = blocks.empty() ? LINE_BLOCK_MIN : min(block_cap * 2, LINE_BLOCK_MAX);
+			if(cap < line.size()) cap = line.size();
+			blocks.emplace_back(new char[cap]);
+			block_cap = cap;
+			block_used = 0;
+		}
+		if(!line.empty()) memcpy(blocks.back().get() + block_used, line.data(), line.size());
+		index.push_back({(uint32_t)(blocks.size() - 1), (uint32_t)block_used, (uint32_t)line.size()});
+		block_used += line.size();
+	}
+	string_view operator[](size_t i) const {
+		const line_ref &r = index[i];
+		return string_view(blocks[r.block].get() + r.offset, r.len);
+	}
+	size_t size() const { return index.size(); }
+	bool empty() const { return index.empty(); }
+};
+
 int speed = 50;
 bool mistakes = false;
 bool stdin_mode = false;
@@ -53,49 +96,314 @@ bool escapes = false;
 bool print_escapes = false;
 int TABSIZE = 8;
 int MISTAKE_CHANCE = 10;
-vector<string> texts;
+line_store texts;
 bool show_all = false;
 bool line_numbers = false;
 bool input_is_binary = false;
 bool allow_resize = false;
 bool debug_enabled = false;
 bool beep_on_error = false;
+bool seed_given = false;
+bool virtual_clock = false;
+bool estimate_only = false;
+long long duration_ns = 0;
+int jobs = 1;
+int fps_cap = 0;
+uint64_t from_line = 1;
+uint64_t to_line = 0;
+bool keep_index = false;
+uint64_t binary_window = 0;
+bool follow_file = false;
+bool follow_from_end = false;
+uint64_t seed_value = 0;
+
+// xoshiro256** random source, generated RNG_BLOCK values at a time.
+static const size_t RNG_BLOCK = 64;
+
+struct rng_state_t {
+	uint64_t s[4];
+	uint64_t block[RNG_BLOCK];
+	size_t next = RNG_BLOCK;
+	uint64_t seed = 0;
+};
+
+rng_state_t rng;
+
+static inline uint64_t rotl64(uint64_t x, int k){ return (x << k) | (x >> (64 - k)); }
+
+void rng_seed(uint64_t seed){
+	rng.seed = seed;
+	uint64_t z = seed;
+	for(int k = 0; k < 4; ++k){
+		z += 0x9E3779B97F4A7C15ULL;
+		uint64_t x = z;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		rng.s[k] = x ^ (x >> 31);
+	}
+	rng.next = RNG_BLOCK;
+}
+
+static void rng_refill(){
+	uint64_t s0 = rng.s[0], s1 = rng.s[1], s2 = rng.s[2], s3 = rng.s[3];
+	for(size_t k = 0; k < RNG_BLOCK; ++k){
+		rng.block[k] = rotl64(s1 * 5, 7) * 9;
+		uint64_t t = s1 << 17;
+		s2 ^= s0; s3 ^= s1; s1 ^= s2; s0 ^= s3;
+		s2 ^= t;
+		s3 = rotl64(s3, 45);
+	}
+	rng.s[0] = s0; rng.s[1] = s1; rng.s[2] = s2; rng.s[3] = s3;
+	rng.next = 0;
+}
+
+// Uniform value in [0, n), by multiply-shift on the top 32 bits.
+static inline uint32_t rng_below(uint32_t n){
+	if(rng.next == RNG_BLOCK) rng_refill();
+	uint64_t x = rng.block[rng.next++] >> 32;
+	return (uint32_t)((x * n) >> 32);
+}
+
+// Typo neighbours, built at compile time from each layout's staggered key rows (x in quarter keys).
+struct keyboard_rows {
+	const char *name;
+	const char *rows[4];
+	const char *shifted[4];
+	int x[4];
+};
+
+static constexpr keyboard_rows keyboard_geometries[] = {
+	{"qwerty", {"`1234567890-=", "qwertyuiop[]\\", "asdfghjkl;'", "zxcvbnm,./"},
+	           {"~!@#$%^&*()_+", "QWERTYUIOP{}|", "ASDFGHJKL:\"", "ZXCVBNM<>?"}, {0, 6, 7, 9}},
+	{"qwertz", {"^1234567890 '", "qwertzuiop +", "asdfghjkl  #", "<yxcvbnm,.-"},
+	           {" !\" $%&/()=?`", "QWERTZUIOP *", "ASDFGHJKL  '", ">YXCVBNM;:_"}, {0, 6, 7, 5}},
+	{"azerty", {" & \"'(- _  )=", "azertyuiop^$", "qsdfghjklm *", "<wxcvbn,;:!"},
+	           {" 1234567890 +", "AZERTYUIOP  ", "QSDFGHJKLM% ", ">WXCVBN?./ "}, {0, 6, 7, 5}},
+	{"dvorak", {"`1234567890[]", "',.pyfgcrl/=\\", "aoeuidhtns-", ";qjkxbmwvz"},
+	           {"~!@#$%^&*(){}", "\"<>PYFGCRL?+|", "AOEUIDHTNS_", ":QJKXBMWVZ"}, {0, 6, 7, 9}},
+	// Polish programmer: US key positions; the Polish letters sit on AltGr
+	// and are multi-byte, so they never take part in single-byte typos.
+	{"pl",     {"`1234567890-=", "qwertyuiop[]\\", "asdfghjkl;'", "zxcvbnm,./"},
+	           {"~!@#$%^&*()_+", "QWERTYUIOP{}|", "ASDFGHJKL:\"", "ZXCVBNM<>?"}, {0, 6, 7, 9}}
+};
+
+static constexpr size_t KEYBOARD_LAYOUTS = sizeof(keyboard_geometries) / sizeof(keyboard_geometries[0]);
+
+struct key_neighbors {
+	char n[8];
+	uint8_t count;
+};
+
+struct keyboard_layout_t {
+	key_neighbors key[256];
+};
+
+static constexpr int key_row_len(const char *r){
+	int n = 0;
+	while(r[n]) ++n;
+	return n;
+}
+
+static constexpr void add_neighbor(key_neighbors &k, char c){
+	if(c == ' ' || k.count >= sizeof(k.n)) return;
+	for(uint8_t q = 0; q < k.count; ++q) if(k.n[q] == c) return;
+	k.n[k.count++] = c;
+}
+
+static constexpr keyboard_layout_t build_keyboard_layout(const keyboard_rows &g){
+	keyboard_layout_t t{};
+	for(int plane = 0; plane < 2; ++plane){
+		const char *const *rows = plane ? g.shifted : g.rows;
+		for(int r = 0; r < 4; ++r){
+			for(int i = 0; i < key_row_len(rows[r]); ++i){
+				char c = rows[r][i];
+				if(c == ' ') continue;
+				key_neighbors &k = t.key[(unsigned char)c];
+				int x = g.x[r] + 4 * i;
+				for(int r2 = (r > 0 ? r - 1 : 0); r2 <= (r < 3 ? r + 1 : 3); ++r2){
+					for(int j = 0; j < key_row_len(rows[r2]); ++j){
+						int dx = g.x[r2] + 4 * j - x;
+						if(dx < 0) dx = -dx;
+						bool near = (r2 == r) ? dx == 4 : dx < 4;
+						if(near) add_neighbor(k, rows[r2][j]);
+					}
+				}
+			}
+		}
+	}
+	return t;
+}
 
-std::mt19937 rng((unsigned)chrono::high_resolution_clock::now().time_since_epoch().count());
-
-unordered_map<string,string> neigh = {
-	{"a","qwsz"}, {"b","vghn"}, {"c","xdfv"}, {"d","ersfcx"}, {"e","wsdr"}, {"f","drtgvc"},
-	{"g","ftyhbv"}, {"h","gyujnb"}, {"i","ujko"}, {"j","huikmn"}, {"k","jiolm"}, {"l","kop"},
-	{"m","njk"}, {"n","bhjm"}, {"o","iklp"}, {"p","ol"}, {"q","wa"}, {"r","edft"},
-	{"s","awedxz"}, {"t","rfgy"}, {"u","yhji"}, {"v","cfgb"}, {"w","qase"}, {"x","zsdc"},
-	{"y","tghu"}, {"z","asx"},
-	{"1","2q"}, {"2","13w"}, {"3","24e"}, {"4","35r"}, {"5","46t"}, {"6","57y"}, {"7","68u"},
-	{"8","79i"}, {"9","80o"}, {"0","9p"},
-	{",","m.<>"}, {".",">,/l"}, {"/",".?;"}, {"\\","|"}, {"|","\\"}, {";","lk'"},
-	{":","L\""}, {"'",";\""}, {"\"",";'"}, {"[","p-]=\\;"}, {"]","[\\'"},
-	{"{","P_+}]"}, {"}","[{\\|"}, {"=","+-"}, {"+","=-"}, {"-","=_"}, {"_","-"},
-	{"(","9"}, {")","0"}, {"*","8"}, {"&","67"}, {"^","45"}, {"%","45"},
-	{"$","34"}, {"#","23"}, {"@","12"}, {"!","12"}, {"~","`"}, {"`","~"}
+static constexpr keyboard_layout_t keyboard_layouts[KEYBOARD_LAYOUTS] = {
+	build_keyboard_layout(keyboard_geometries[0]),
+	build_keyboard_layout(keyboard_geometries[1]),
+	build_keyboard_layout(keyboard_geometries[2]),
+	build_keyboard_layout(keyboard_geometries[3]),
+	build_keyboard_layout(keyboard_geometries[4])
 };
 
+const keyboard_layout_t *keyboard = &keyboard_layouts[0];
+
 volatile sig_atomic_t sig_flag = 0;
 static int sig_pipe_fds[2] = {-1, -1};
 
+// Cached terminal width; signal_handler marks it stale on SIGWINCH.
+volatile sig_atomic_t cols_dirty = 1;
+static int cached_cols = 80;
+
 int get_cols(){
-	struct winsize w{};
-	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1) return 80;
-	if(w.ws_col == 0) return 80;
-	return (int)w.ws_col;
+	if(cols_dirty){
+		cols_dirty = 0;
+		struct winsize w{};
+		// stderr still reports the real width when --virtual-clock output is redirected.
+		if((ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1 || w.ws_col == 0) &&
+		   (ioctl(STDERR_FILENO, TIOCGWINSZ, &w) == -1 || w.ws_col == 0)) cached_cols = 80;
+		else cached_cols = (int)w.ws_col;
+	}
+	return cached_cols;
 }
 
-double calc_delay(){
+// One delay unit: (100 - speed) plus a random extra of up to the same
+// amount. calc_delay_ns() scales a unit by 1/1500 s.
+int calc_delay_weight(){
 	int value = 100 - speed;
-	int max_r = value > 0 ? value - 1 : 0;
-	uniform_int_distribution<int> dist(0, max_r);
-	int chosen = dist(rng);
+	int chosen = value > 0 ? (int)rng_below((uint32_t)value) : 0;
 	int finalv = value + chosen;
 	if(finalv < 1) finalv = 1;
-	return (double)finalv / 1500.0;
+	return finalv;
+}
+
+long long calc_delay_ns(){
+	return (long long)calc_delay_weight() * 2000000LL / 3;
+}
+
+void handle_signal_event(int signo);
+
+// What event_wait() woke up for; several bits can be set at once.
+enum { EV_TIMER = 1, EV_INPUT = 2, EV_SIGNAL = 4 };
+int event_wait(long long deadline_ns, int input_fd);
+bool event_poll_signals();
+bool frame_hold(long long due_ns);
+void frame_flush();
+
+// Typing clock: waits run against absolute monotonic deadlines.
+struct typing_clock {
+	long long deadline_ns = 0;
+	long long anchor_ns = 0;
+	long long planned_ns = 0;
+	long long active_ns = 0;
+	bool running = false;
+	long long weight_sum = 0;
+	long long budget_ns = 0;
+	long long budget_weight = 0;
+	long long end_ns = 0;
+};
+
+typing_clock tclock;
+
+// How far behind the typing clock may fall before it stops catching up.
+const long long catchup_max_ns = 100000000LL;
+
+static long long mono_now_ns(){
+	struct timespec ts{};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Typing sleeps go through the event loop, so a signal ends them at once.
+static void sleep_until_ns(long long target){
+	while(true){
+		if(sig_flag){
+			int signo = sig_flag;
+			sig_flag = 0;
+			handle_signal_event(signo);
+		}
+		if(event_wait(target, -1) & EV_TIMER) return;
+	}
+}
+
+static long long next_delay_ns(long long now){
+	int w = calc_delay_weight();
+	tclock.weight_sum += w;
+	if(tclock.budget_ns <= 0) return (long long)w * 2000000LL / 3;
+	if(tclock.deadline_ns < now) tclock.deadline_ns = now;
+	long long left_ns = tclock.end_ns - tclock.deadline_ns;
+	long long left_w = tclock.budget_weight - (tclock.weight_sum - w);
+	if(left_ns <= 0 || left_w <= 0) return 0;
+	if(w > left_w) w = (int)left_w;
+	return left_ns * w / left_w;
+}
+
+void typing_wait(int units){
+	// --virtual-clock: simulated time only moves forward; nothing sleeps.
+	if(virtual_clock){
+		if(tclock.end_ns == 0) tclock.end_ns = tclock.deadline_ns + tclock.budget_ns;
+		for(int k = 0; k < units; ++k){
+			long long d = next_delay_ns(tclock.deadline_ns);
+			tclock.deadline_ns += d;
+			tclock.planned_ns += d;
+		}
+		frame_hold(tclock.deadline_ns);
+		// Nothing blocks here, so pick up signals from the signalfd now and then.
+		static unsigned virtual_waits = 0;
+		if((++virtual_waits & 4095) == 0) event_poll_signals();
+		if(sig_flag){
+			int signo = sig_flag;
+			sig_flag = 0;
+			handle_signal_event(signo);
+		}
+		return;
+	}
+	if(!tclock.running){
+		tclock.anchor_ns = tclock.deadline_ns = mono_now_ns();
+		if(tclock.end_ns == 0) tclock.end_ns = tclock.anchor_ns + tclock.budget_ns;
+		tclock.running = true;
+	}
+	long long now = mono_now_ns();
+	if(tclock.budget_ns <= 0 && now - tclock.deadline_ns > catchup_max_ns){
+		tclock.anchor_ns += now - tclock.deadline_ns;
+		tclock.deadline_ns = now;
+	}
+	for(int k = 0; k < units; ++k){
+		long long d = next_delay_ns(now);
+		tclock.deadline_ns += d;
+		tclock.planned_ns += d;
+	}
+	if(frame_hold(tclock.deadline_ns)) return;
+	sleep_until_ns(tclock.deadline_ns);
+}
+
+// Sends the held paced frame once its last deadline has passed.
+void typing_finish(){
+	if(!virtual_clock && tclock.running && tclock.deadline_ns > mono_now_ns()) sleep_until_ns(tclock.deadline_ns);
+	frame_flush();
+}
+
+void typing_clock_pause(){
+	if(virtual_clock || !tclock.running) return;
+	tclock.active_ns += mono_now_ns() - tclock.anchor_ns;
+	tclock.running = false;
+}
+
+void typing_clock_reset(){
+	tclock = typing_clock();
+}
+
+void print_timing_stats(){
+	long long actual = tclock.active_ns;
+	if(tclock.running) actual += mono_now_ns() - tclock.anchor_ns;
+	string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
+	cerr << dbg_prefix << " timing seed=" << rng.seed;
+	if(tclock.budget_ns > 0) cerr << " target=" << (double)tclock.budget_ns / 1e9 << "s";
+	cerr << " planned=" << (double)tclock.planned_ns / 1e9 << "s actual="
+		 << (double)actual / 1e9 << "s drift=" << (double)(actual - tclock.planned_ns) / 1e6 << "ms" << endl;
+}
+
+// Positive decimal option value (line numbers, byte counts); 0 if invalid.
+uint64_t parse_count(const string &v){
+	if(v.empty() || v.size() > 18) return 0;
+	for(char c: v) if(!isdigit((unsigned char)c)) return 0;
+	return strtoull(v.c_str(), nullptr, 10);
 }
 
 string basename_of(const string &path){
@@ -104,32 +412,61 @@ string basename_of(const string &path){
 	return path.substr(p+1);
 }
 
-bool looks_binary(const string &data){
-	if(data.empty()) return false;
-	size_t sample = min((size_t)4096, data.size());
-	size_t nonprint = 0;
-	for(size_t i=0;i<sample;++i){
-		unsigned char c = (unsigned char)data[i];
-		if(c == 0) return true;
-		if(c < 0x09) { nonprint++; continue; }
-		if(c > 0x0D && c < 0x20) { nonprint++; continue; }
-	}
-	double frac = (double)nonprint / (double)sample;
-	return frac > 0.30;
+// Escape normalizer: one linear pass into a reused buffer.
+static size_t literal_escape_len(string_view s, size_t i){
+	if(s[i] != '\\' || i + 1 >= s.size()) return 0;
+	if(s[i+1] == 'e') return 2;
+	if(i + 3 < s.size() && ((s[i+1] == 'x' && s[i+2] == '1' && s[i+3] == 'b') ||
+							(s[i+1] == '0' && s[i+2] == '3' && s[i+3] == '3'))) return 4;
+	return 0;
 }
 
-void replace_all(string &s, const string &from, const string &to){
-	if(from.empty()) return;
-	size_t pos = 0;
-	while((pos = s.find(from, pos)) != string::npos){
-		s.replace(pos, from.size(), to);
-		pos += to.size();
+// Reads the line as if every literal escape had already been replaced by ESC.
+struct expand_cursor {
+	string_view s;
+	size_t i = 0;
+	bool done() const { return i >= s.size(); }
+	unsigned char peek() const { return literal_escape_len(s, i) ? 0x1B : (unsigned char)s[i]; }
+	unsigned char get(){
+		size_t k = literal_escape_len(s, i);
+		if(k){ i += k; return 0x1B; }
+		return (unsigned char)s[i++];
+	}
+};
+
+// Drops \e, \x1b and \033 in turn, like the old chain of replaces.
+struct literal_dropper {
+	const char *pat;
+	size_t len;
+	size_t m;
+};
+
+static void drop_feed(literal_dropper *chain, size_t k, size_t n, char c, string &out){
+	if(k == n){ out.push_back(c); return; }
+	literal_dropper &st = chain[k];
+	if(st.m > 0){
+		if(c == st.pat[st.m]){
+			if(++st.m == st.len) st.m = 0;
+			return;
+		}
+		size_t held = st.m;
+		st.m = 0;
+		for(size_t q = 0; q < held; ++q) drop_feed(chain, k + 1, n, st.pat[q], out);
 	}
+	if(c == '\\'){ st.m = 1; return; }
+	drop_feed(chain, k + 1, n, c, out);
+}
+
+static void drop_flush(literal_dropper *chain, size_t k, size_t n, string &out){
+	if(k == n) return;
+	size_t held = chain[k].m;
+	chain[k].m = 0;
+	for(size_t q = 0; q < held; ++q) drop_feed(chain, k + 1, n, chain[k].pat[q], out);
+	drop_flush(chain, k + 1, n, out);
 }
 
-string strip_ansi(const string &s){
-	string out;
-	out.reserve(s.size());
+static void strip_escapes(string_view s, string &out){
+	literal_dropper chain[3] = { {"\\e", 2, 0}, {"\\x1b", 4, 0}, {"\\033", 4, 0} };
 	size_t i = 0, n = s.size();
 	while(i < n){
 		unsigned char ch = (unsigned char)s[i];
@@ -152,102 +489,226 @@ string strip_ansi(const string &s){
 				}
 				continue;
 			}
-			if(i < n) { ++i; continue; }
+			if(i < n) ++i;
 			continue;
 		}
-		out.push_back((char)ch);
+		drop_feed(chain, 0, 3, (char)ch, out);
 		++i;
 	}
-	return out;
+	drop_flush(chain, 0, 3, out);
 }
 
-string render_escapes_as_text(const string &s){
-	string out;
-	out.reserve(s.size() * 2);
-	size_t i = 0, n = s.size();
-	while(i < n){
-		unsigned char ch = (unsigned char)s[i];
-		if(ch == 0x1B){
-			if(i + 1 < n){
-				unsigned char next = (unsigned char)s[i+1];
-				if(next == '['){
-					size_t j = i + 2;
-					string content;
-					while(j < n){
-						unsigned char c = (unsigned char)s[j++];
-						content.push_back((char)c);
-						if(c >= 0x40 && c <= 0x7E) break;
-					}
-					out += "\\e[";
-					out += content;
-					i = j;
-					continue;
-				} else if(next == ']'){
-					size_t j = i + 2;
-					string content;
-					bool terminator_found = false;
-					while(j < n){
-						unsigned char c = (unsigned char)s[j++];
-						if(c == '\a'){ terminator_found = true; break; }
-						if(c == 0x1B && j < n && s[j] == '\\'){ terminator_found = true; ++j; break; }
-						content.push_back((char)c);
-					}
-					out += "\\e]";
-					out += content;
-					if(terminator_found) out += "<TERM>";
-					i = j;
-					continue;
-				} else {
-					out += "\\e";
-					out.push_back((char)next);
-					i += 2;
-					continue;
-				}
-			} else {
-				out += "\\e";
-				++i;
-				continue;
+static void textualize_escapes(string_view s, string &out){
+	expand_cursor c{s};
+	while(!c.done()){
+		unsigned char ch = c.get();
+		if(ch != 0x1B){
+			out.push_back((char)ch);
+			continue;
+		}
+		if(c.done()){
+			out += "\\e";
+			continue;
+		}
+		unsigned char next = c.get();
+		if(next == '['){
+			out += "\\e[";
+			while(!c.done()){
+				unsigned char cc = c.get();
+				out.push_back((char)cc);
+				if(cc >= 0x40 && cc <= 0x7E) break;
 			}
+		} else if(next == ']'){
+			out += "\\e]";
+			bool terminator_found = false;
+			while(!c.done()){
+				unsigned char cc = c.get();
+				if(cc == '\a'){ terminator_found = true; break; }
+				if(cc == 0x1B && !c.done() && c.peek() == '\\'){ terminator_found = true; c.get(); break; }
+				out.push_back((char)cc);
+			}
+			if(terminator_found) out += "<TERM>";
 		} else {
-			out.push_back((char)ch);
-			++i;
+			out += "\\e";
+			out.push_back((char)next);
 		}
 	}
-	return out;
+}
+
+void normalize_line(string_view raw, string &out){
+	out.clear();
+	if(raw.find_first_of("\x1B\\") == string_view::npos){
+		out.append(raw.data(), raw.size());
+		return;
+	}
+	if(print_escapes){
+		textualize_escapes(raw, out);
+	} else if(escapes){
+		expand_cursor c{raw};
+		while(!c.done()) out.push_back((char)c.get());
+	} else {
+		strip_escapes(raw, out);
+	}
 }
 
 struct unicode_interval { uint32_t first; uint32_t last; };
 
-static const unicode_interval combining_intervals[] = {
-	{0x0300, 0x036F},
-	{0x1AB0, 0x1AFF},
-	{0x1DC0, 0x1DFF},
-	{0x20D0, 0x20FF},
-	{0xFE20, 0xFE2F}
+// Zero-width code points (Mn, Me, Cf minus U+00AD, Hangul jamo, variation selectors), Unicode 15.1.
+static constexpr unicode_interval zero_width_intervals[] = {
+	{0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0600, 0x0605},
+	{0x0610, 0x061A}, {0x061C, 0x061C}, {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DD}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED},
+	{0x070F, 0x070F}, {0x0711, 0x0711}, {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x07FD, 0x07FD}, {0x0816, 0x0819}, {0x081B, 0x0823},
+	{0x0825, 0x0827}, {0x0829, 0x082D}, {0x0859, 0x085B}, {0x0890, 0x0891}, {0x0898, 0x089F}, {0x08CA, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C},
+	{0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD},
+	{0x09E2, 0x09E3}, {0x09FE, 0x09FE}, {0x0A01, 0x0A02}, {0x0A3C, 0x0A3C}, {0x0A41, 0x0A42}, {0x0A47, 0x0A48}, {0x0A4B, 0x0A4D}, {0x0A51, 0x0A51},
+	{0x0A70, 0x0A71}, {0x0A75, 0x0A75}, {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC5}, {0x0AC7, 0x0AC8}, {0x0ACD, 0x0ACD}, {0x0AE2, 0x0AE3},
+	{0x0AFA, 0x0AFF}, {0x0B01, 0x0B01}, {0x0B3C, 0x0B3C}, {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B4D}, {0x0B55, 0x0B56}, {0x0B62, 0x0B63},
+	{0x0B82, 0x0B82}, {0x0BC0, 0x0BC0}, {0x0BCD, 0x0BCD}, {0x0C00, 0x0C00}, {0x0C04, 0x0C04}, {0x0C3C, 0x0C3C}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C48},
+	{0x0C4A, 0x0C4D}, {0x0C55, 0x0C56}, {0x0C62, 0x0C63}, {0x0C81, 0x0C81}, {0x0CBC, 0x0CBC}, {0x0CBF, 0x0CBF}, {0x0CC6, 0x0CC6}, {0x0CCC, 0x0CCD},
+	{0x0CE2, 0x0CE3}, {0x0D00, 0x0D01}, {0x0D3B, 0x0D3C}, {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0D62, 0x0D63}, {0x0D81, 0x0D81}, {0x0DCA, 0x0DCA},
+	{0x0DD2, 0x0DD4}, {0x0DD6, 0x0DD6}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECE},
+	{0x0F18, 0x0F19}, {0x0F35, 0x0F35}, {0x0F37, 0x0F37}, {0x0F39, 0x0F39}, {0x0F71, 0x0F7E}, {0x0F80, 0x0F84}, {0x0F86, 0x0F87}, {0x0F8D, 0x0F97},
+	{0x0F99, 0x0FBC}, {0x0FC6, 0x0FC6}, {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A}, {0x103D, 0x103E}, {0x1058, 0x1059}, {0x105E, 0x1060},
+	{0x1071, 0x1074}, {0x1082, 0x1082}, {0x1085, 0x1086}, {0x108D, 0x108D}, {0x109D, 0x109D}, {0x1160, 0x11FF}, {0x135D, 0x135F}, {0x1712, 0x1714},
+	{0x1732, 0x1733}, {0x1752, 0x1753}, {0x1772, 0x1773}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6}, {0x17C9, 0x17D3}, {0x17DD, 0x17DD},
+	{0x180B, 0x180F}, {0x1885, 0x1886}, {0x18A9, 0x18A9}, {0x1920, 0x1922}, {0x1927, 0x1928}, {0x1932, 0x1932}, {0x1939, 0x193B}, {0x1A17, 0x1A18},
+	{0x1A1B, 0x1A1B}, {0x1A56, 0x1A56}, {0x1A58, 0x1A5E}, {0x1A60, 0x1A60}, {0x1A62, 0x1A62}, {0x1A65, 0x1A6C}, {0x1A73, 0x1A7C}, {0x1A7F, 0x1A7F},
+	{0x1AB0, 0x1ACE}, {0x1B00, 0x1B03}, {0x1B34, 0x1B34}, {0x1B36, 0x1B3A}, {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42}, {0x1B6B, 0x1B73}, {0x1B80, 0x1B81},
+	{0x1BA2, 0x1BA5}, {0x1BA8, 0x1BA9}, {0x1BAB, 0x1BAD}, {0x1BE6, 0x1BE6}, {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED}, {0x1BEF, 0x1BF1}, {0x1C2C, 0x1C33},
+	{0x1C36, 0x1C37}, {0x1CD0, 0x1CD2}, {0x1CD4, 0x1CE0}, {0x1CE2, 0x1CE8}, {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4}, {0x1CF8, 0x1CF9}, {0x1DC0, 0x1DFF},
+	{0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064}, {0x2066, 0x206F}, {0x20D0, 0x20F0}, {0x2CEF, 0x2CF1}, {0x2D7F, 0x2D7F}, {0x2DE0, 0x2DFF},
+	{0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672}, {0xA674, 0xA67D}, {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1}, {0xA802, 0xA802}, {0xA806, 0xA806},
+	{0xA80B, 0xA80B}, {0xA825, 0xA826}, {0xA82C, 0xA82C}, {0xA8C4, 0xA8C5}, {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF}, {0xA926, 0xA92D}, {0xA947, 0xA951},
+	{0xA980, 0xA982}, {0xA9B3, 0xA9B3}, {0xA9B6, 0xA9B9}, {0xA9BC, 0xA9BD}, {0xA9E5, 0xA9E5}, {0xAA29, 0xAA2E}, {0xAA31, 0xAA32}, {0xAA35, 0xAA36},
+	{0xAA43, 0xAA43}, {0xAA4C, 0xAA4C}, {0xAA7C, 0xAA7C}, {0xAAB0, 0xAAB0}, {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8}, {0xAABE, 0xAABF}, {0xAAC1, 0xAAC1},
+	{0xAAEC, 0xAAED}, {0xAAF6, 0xAAF6}, {0xABE5, 0xABE5}, {0xABE8, 0xABE8}, {0xABED, 0xABED}, {0xD7B0, 0xD7FF}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F},
+	{0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xFFF9, 0xFFFB}, {0x101FD, 0x101FD}, {0x102E0, 0x102E0}, {0x10376, 0x1037A}, {0x10A01, 0x10A03}, {0x10A05, 0x10A06},
+	{0x10A0C, 0x10A0F}, {0x10A38, 0x10A3A}, {0x10A3F, 0x10A3F}, {0x10AE5, 0x10AE6}, {0x10D24, 0x10D27}, {0x10EAB, 0x10EAC}, {0x10EFD, 0x10EFF}, {0x10F46, 0x10F50},
+	{0x10F82, 0x10F85}, {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070}, {0x11073, 0x11074}, {0x1107F, 0x11081}, {0x110B3, 0x110B6}, {0x110B9, 0x110BA},
+	{0x110BD, 0x110BD}, {0x110C2, 0x110C2}, {0x110CD, 0x110CD}, {0x11100, 0x11102}, {0x11127, 0x1112B}, {0x1112D, 0x11134}, {0x11173, 0x11173}, {0x11180, 0x11181},
+	{0x111B6, 0x111BE}, {0x111C9, 0x111CC}, {0x111CF, 0x111CF}, {0x1122F, 0x11231}, {0x11234, 0x11234}, {0x11236, 0x11237}, {0x1123E, 0x1123E}, {0x11241, 0x11241},
+	{0x112DF, 0x112DF}, {0x112E3, 0x112EA}, {0x11300, 0x11301}, {0x1133B, 0x1133C}, {0x11340, 0x11340}, {0x11366, 0x1136C}, {0x11370, 0x11374}, {0x11438, 0x1143F},
+	{0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145E, 0x1145E}, {0x114B3, 0x114B8}, {0x114BA, 0x114BA}, {0x114BF, 0x114C0}, {0x114C2, 0x114C3}, {0x115B2, 0x115B5},
+	{0x115BC, 0x115BD}, {0x115BF, 0x115C0}, {0x115DC, 0x115DD}, {0x11633, 0x1163A}, {0x1163D, 0x1163D}, {0x1163F, 0x11640}, {0x116AB, 0x116AB}, {0x116AD, 0x116AD},
+	{0x116B0, 0x116B5}, {0x116B7, 0x116B7}, {0x1171D, 0x1171F}, {0x11722, 0x11725}, {0x11727, 0x1172B}, {0x1182F, 0x11837}, {0x11839, 0x1183A}, {0x1193B, 0x1193C},
+	{0x1193E, 0x1193E}, {0x11943, 0x11943}, {0x119D4, 0x119D7}, {0x119DA, 0x119DB}, {0x119E0, 0x119E0}, {0x11A01, 0x11A0A}, {0x11A33, 0x11A38}, {0x11A3B, 0x11A3E},
+	{0x11A47, 0x11A47}, {0x11A51, 0x11A56}, {0x11A59, 0x11A5B}, {0x11A8A, 0x11A96}, {0x11A98, 0x11A99}, {0x11C30, 0x11C36}, {0x11C38, 0x11C3D}, {0x11C3F, 0x11C3F},
+	{0x11C92, 0x11CA7}, {0x11CAA, 0x11CB0}, {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6}, {0x11D31, 0x11D36}, {0x11D3A, 0x11D3A}, {0x11D3C, 0x11D3D}, {0x11D3F, 0x11D45},
+	{0x11D47, 0x11D47}, {0x11D90, 0x11D91}, {0x11D95, 0x11D95}, {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4}, {0x11F00, 0x11F01}, {0x11F36, 0x11F3A}, {0x11F40, 0x11F40},
+	{0x11F42, 0x11F42}, {0x13430, 0x13440}, {0x13447, 0x13455}, {0x16AF0, 0x16AF4}, {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F}, {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4},
+	{0x1BC9D, 0x1BC9E}, {0x1BCA0, 0x1BCA3}, {0x1CF00, 0x1CF2D}, {0x1CF30, 0x1CF46}, {0x1D167, 0x1D169}, {0x1D173, 0x1D182}, {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD},
+	{0x1D242, 0x1D244}, {0x1DA00, 0x1DA36}, {0x1DA3B, 0x1DA6C}, {0x1DA75, 0x1DA75}, {0x1DA84, 0x1DA84}, {0x1DA9B, 0x1DA9F}, {0x1DAA1, 0x1DAAF}, {0x1E000, 0x1E006},
+	{0x1E008, 0x1E018}, {0x1E01B, 0x1E021}, {0x1E023, 0x1E024}, {0x1E026, 0x1E02A}, {0x1E08F, 0x1E08F}, {0x1E130, 0x1E136}, {0x1E2AE, 0x1E2AE}, {0x1E2EC, 0x1E2EF},
+	{0x1E4EC, 0x1E4EF}, {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A}, {0xE0001, 0xE0001}, {0xE0020, 0xE007F}, {0xE0100, 0xE01EF}
+};
+
+// Wide (W) and fullwidth (F) code points, emoji presentation included, from
+// Unicode 15.1 EastAsianWidth.txt; sorted.
+static constexpr unicode_interval wide_intervals[] = {
+	{0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+	{0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+	{0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5}, {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+	{0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+	{0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x2E99}, {0x2E9B, 0x2EF3}, {0x2F00, 0x2FD5}, {0x2FF0, 0x303E}, {0x3041, 0x3096},
+	{0x3099, 0x30FF}, {0x3105, 0x312F}, {0x3131, 0x318E}, {0x3190, 0x31E3}, {0x31EF, 0x321E}, {0x3220, 0x3247}, {0x3250, 0x4DBF}, {0x4E00, 0xA48C},
+	{0xA490, 0xA4C6}, {0xA960, 0xA97C}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE52}, {0xFE54, 0xFE66}, {0xFE68, 0xFE6B},
+	{0xFF01, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x16FF0, 0x16FF1}, {0x17000, 0x187F7}, {0x18800, 0x18CD5}, {0x18D00, 0x18D08}, {0x1AFF0, 0x1AFF3},
+	{0x1AFF5, 0x1AFFB}, {0x1AFFD, 0x1AFFE}, {0x1B000, 0x1B122}, {0x1B132, 0x1B132}, {0x1B150, 0x1B152}, {0x1B155, 0x1B155}, {0x1B164, 0x1B167}, {0x1B170, 0x1B2FB},
+	{0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}, {0x1F250, 0x1F251},
+	{0x1F260, 0x1F265}, {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0},
+	{0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A},
+	{0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6DC, 0x1F6DF},
+	{0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F7F0, 0x1F7F0}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FA7C},
+	{0x1FA80, 0x1FA88}, {0x1FA90, 0x1FABD}, {0x1FABF, 0x1FAC5}, {0x1FACE, 0x1FADB}, {0x1FAE0, 0x1FAE8}, {0x1FAF0, 0x1FAF8}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
 };
 
-static const unicode_interval wide_intervals[] = {
-	{0x1100, 0x115F},
-	{0x2329, 0x232A},
-	{0x2E80, 0xA4CF},
-	{0xAC00, 0xD7A3},
-	{0xF900, 0xFAFF},
-	{0xFE10, 0xFE19},
-	{0xFE30, 0xFE6F},
-	{0xFF00, 0xFF60},
-	{0xFFE0, 0xFFE6},
-	{0x20000, 0x2FFFD},
-	{0x30000, 0x3FFFD}
+// Display widths as a two-level table (cp >> 8 -> page of 2-bit widths), built at compile time.
+static constexpr size_t WIDTH_PAGES = 0x110000 >> 8;
+static constexpr uint8_t WIDTH_MIXED = 3;
+
+struct width_page_kinds_t { uint8_t kind[WIDTH_PAGES]; };
+
+static constexpr void mark_page_kinds(width_page_kinds_t &m, const unicode_interval *iv, size_t n, uint8_t w){
+	for(size_t k = 0; k < n; ++k){
+		for(uint32_t page = iv[k].first >> 8; page <= (iv[k].last >> 8); ++page){
+			uint32_t lo = page << 8, hi = lo | 0xFF;
+			if(iv[k].first <= lo && iv[k].last >= hi){
+				if(m.kind[page] != WIDTH_MIXED) m.kind[page] = w;
+			} else {
+				m.kind[page] = WIDTH_MIXED;
+			}
+		}
+	}
+}
+
+static constexpr width_page_kinds_t build_page_kinds(){
+	width_page_kinds_t m{};
+	for(size_t p = 0; p < WIDTH_PAGES; ++p) m.kind[p] = 1;
+	mark_page_kinds(m, wide_intervals, sizeof(wide_intervals)/sizeof(wide_intervals[0]), 2);
+	mark_page_kinds(m, zero_width_intervals, sizeof(zero_width_intervals)/sizeof(zero_width_intervals[0]), 0);
+	m.kind[0] = WIDTH_MIXED;
+	return m;
+}
+
+static constexpr width_page_kinds_t width_page_kinds = build_page_kinds();
+
+static constexpr size_t count_mixed_pages(){
+	size_t n = 0;
+	for(size_t p = 0; p < WIDTH_PAGES; ++p) if(width_page_kinds.kind[p] == WIDTH_MIXED) ++n;
+	return n;
+}
+
+// Shared uniform pages come first: width 1, width 2, width 0.
+static constexpr size_t WIDTH_TABLE_PAGES = 3 + count_mixed_pages();
+static_assert(WIDTH_TABLE_PAGES <= 256, "stage1 entries are one byte");
+
+struct width_table_t {
+	uint8_t stage1[WIDTH_PAGES];
+	uint8_t stage2[WIDTH_TABLE_PAGES][64];
 };
 
-static bool is_in_intervals(const unicode_interval *table, size_t table_len, uint32_t codepoint){
-	for(size_t k = 0; k < table_len; ++k){
-		if(codepoint >= table[k].first && codepoint <= table[k].last) return true;
+static constexpr void paint_widths(width_table_t &t, uint32_t first, uint32_t last, uint8_t w){
+	for(uint32_t page = first >> 8; page <= (last >> 8); ++page){
+		if(width_page_kinds.kind[page] != WIDTH_MIXED) continue;
+		uint8_t *bits = t.stage2[t.stage1[page]];
+		uint32_t lo = first > (page << 8) ? first : (page << 8);
+		uint32_t hi = last < ((page << 8) | 0xFF) ? last : ((page << 8) | 0xFF);
+		for(uint32_t cp = lo; cp <= hi; ++cp){
+			uint8_t &b = bits[(cp & 0xFF) >> 2];
+			unsigned shift = (cp & 3) * 2;
+			b = (uint8_t)((b & ~(3u << shift)) | ((unsigned)w << shift));
+		}
+	}
+}
+
+static constexpr width_table_t build_width_table(){
+	width_table_t t{};
+	for(size_t k = 0; k < 64; ++k){
+		t.stage2[0][k] = 0x55;
+		t.stage2[1][k] = 0xAA;
+		t.stage2[2][k] = 0x00;
 	}
-	return false;
+	size_t next = 3;
+	for(size_t p = 0; p < WIDTH_PAGES; ++p){
+		uint8_t kind = width_page_kinds.kind[p];
+		if(kind == WIDTH_MIXED){
+			t.stage1[p] = (uint8_t)next;
+			for(size_t k = 0; k < 64; ++k) t.stage2[next][k] = 0x55;
+			++next;
+		} else {
+			t.stage1[p] = kind == 1 ? 0 : (kind == 2 ? 1 : 2);
+		}
+	}
+	for(const unicode_interval &iv : wide_intervals) paint_widths(t, iv.first, iv.last, 2);
+	for(const unicode_interval &iv : zero_width_intervals) paint_widths(t, iv.first, iv.last, 0);
+	paint_widths(t, 0x00, 0x1F, 0);
+	paint_widths(t, 0x7F, 0x9F, 0);
+	return t;
 }
 
-static uint32_t utf8_decode_codepoint(const std::string &s, size_t i, int &bytes){
+static constexpr width_table_t unicode_widths = build_width_table();
+
+static uint32_t utf8_decode_codepoint(string_view s, size_t i, int &bytes){
 	size_t n = s.size();
 	if(i >= n){ bytes = 0; return 0; }
 	unsigned char b0 = (unsigned char)s[i];
@@ -292,135 +753,642 @@ static uint32_t utf8_decode_codepoint(const std::string &s, size_t i, int &bytes
 	return 0xFFFD;
 }
 
-static int unicode_wcwidth(uint32_t ucs){
-	if(ucs == 0) return 0;
-	if(ucs < 32 || (ucs >= 0x7f && ucs < 0xa0)) return 0;
-	if(is_in_intervals(combining_intervals, sizeof(combining_intervals)/sizeof(combining_intervals[0]), ucs)) return 0;
-	if(is_in_intervals(wide_intervals, sizeof(wide_intervals)/sizeof(wide_intervals[0]), ucs)) return 2;
-	return 1;
+static inline int unicode_wcwidth(uint32_t ucs){
+	if(ucs >= 0x110000) return 1;
+	const uint8_t *bits = unicode_widths.stage2[unicode_widths.stage1[ucs >> 8]];
+	return (bits[(ucs & 0xFF) >> 2] >> ((ucs & 3) * 2)) & 3;
 }
 
-static std::string utf8_next_glyph(const std::string &s, size_t i, int &bytes, int &width){
-	int b = 0;
-	uint32_t cp = utf8_decode_codepoint(s, i, b);
-	bytes = b;
-	if(bytes <= 0) bytes = 1;
-	if(i + (size_t)bytes > s.size()) bytes = (int)max((size_t)1, s.size() - i);
-	width = unicode_wcwidth(cp);
-	if(width < 0) width = 1;
-	return s.substr(i, bytes);
-}
-
-char pick_neighbor(char ch){
-	char lower = (char)tolower((unsigned char)ch);
-	string key; key.push_back(lower);
-	auto it = neigh.find(key);
-	if(it != neigh.end()){
-		const string &nset = it->second;
-		uniform_int_distribution<int> d(0, (int)nset.size()-1);
-		char w = nset[d(rng)];
-		if(isupper((unsigned char)ch)) w = (char)toupper((unsigned char)w);
-		return w;
+// ASCII fast path: length of the printable-ASCII run at p.
+static size_t ascii_run_len_scalar(const char *p, size_t n){
+	size_t i = 0;
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	while(i + 8 <= n){
+		uint64_t x;
+		memcpy(&x, p + i, 8);
+		uint64_t low = (x - ones * 0x20) & ~x;
+		uint64_t del = x ^ (ones * 0x7F);
+		del = (del - ones) & ~del;
+		if((low | del | x) & highs) break;
+		i += 8;
 	}
-	return ch;
+	while(i < n){
+		unsigned char c = (unsigned char)p[i];
+		if(c < 0x20 || c > 0x7E) break;
+		++i;
+	}
+	return i;
 }
 
-bool is_mistake(){
-	if(MISTAKE_CHANCE <= 0) return false;
-	uniform_int_distribution<int> d(1,100);
-	int r = d(rng);
-	if(r <= MISTAKE_CHANCE) return true;
-	this_thread::sleep_for(chrono::duration<double>(calc_delay()));
-	return false;
+#if defined(__SSE2__)
+static size_t ascii_run_len_sse2(const char *p, size_t n){
+	size_t i = 0;
+	const __m128i lo = _mm_set1_epi8(0x1F);
+	const __m128i del = _mm_set1_epi8(0x7F);
+	while(i + 16 <= n){
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		// Signed compare: bytes >= 0x80 are negative and fail "> 0x1F".
+		__m128i ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, del), _mm_cmpgt_epi8(v, lo));
+		unsigned mask = (unsigned)_mm_movemask_epi8(ok);
+		if(mask != 0xFFFFu) return i + (size_t)__builtin_ctz(~mask);
+		i += 16;
+	}
+	return i + ascii_run_len_scalar(p + i, n - i);
 }
+#endif
 
-void print_hide_cursor(){ cout << "\x1B[?25l" << flush; }
-void print_show_cursor(){ cout << "\x1B[?25h" << flush; }
-
-void print_help(const string &prog_base){
-	cout << prog_base << " v1.1 (c) Kamil BuriXon Burek 2026\n\n";
-	cout << "Usage:\n";
-	cout << "  " << prog_base << " [options] [file]\n\n";
-	cout << "Options:\n";
-	cout << "  -s, --speed <1-100>       Typing speed (default 50). 100 = minimal delay.\n";
-	cout << "  -m, --mistakes <1-100>    Enable random mistakes. Optionally set chance 1-100 (default off|10).\n";
-	cout << "  -c, --color               Interpret ANSI escape sequences (emit colors).\n";
-	cout << "  -e, --print-escapes       Print ANSI escapes textually as \\e[..., not as colors.\n";
-	cout << "                            (conflicts with -c/--color)\n";
-	cout << "  -b, --beep                Emit BEL on non-zero exit code.\n";
-	cout << "  -t, --text <string>       Add a text line to display (can be repeated).\n";
-	cout << "  -a, --show-all            Force showing input even if detected as binary.\n";
-	cout << "  -n, --line-numbers        Prepend dimmed line numbers (N| ) to each line.\n";
-	cout << "  -r, --allow-resize        Allow terminal resize (SIGWINCH) during typing.\n";
-	cout << "  -h, --help                Show this help and exit.\n";
-	cout << "  -v, --version             Show program version and exit.\n";
-	cout << "  --codes                   Show a list of exit codes and signal handling details.\n\n";
-	cout << "Input:\n";
-	cout << "  If no file is provided and stdin is a TTY, program reads lines as you\n";
-	cout << "  type them (press Enter to send a line). If stdin is piped, the whole\n";
-	cout << "  input is consumed and displayed.\n\n";
-	cout << "License: GPLv3.0\n";
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static size_t ascii_run_len_avx2(const char *p, size_t n){
+	size_t i = 0;
+	const __m256i lo = _mm256_set1_epi8(0x1F);
+	const __m256i del = _mm256_set1_epi8(0x7F);
+	while(i + 32 <= n){
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del), _mm256_cmpgt_epi8(v, lo));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(ok);
+		if(mask != 0xFFFFFFFFu) return i + (size_t)__builtin_ctz(~mask);
+		i += 32;
+	}
+	return i + ascii_run_len_sse2(p + i, n - i);
 }
+#endif
 
-void print_version(const string &prog_base){
-	cout << prog_base << " v1.1 (c) Kamil BuriXon Burek 2026\n";
+static size_t (*resolve_ascii_run_len())(const char *, size_t){
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) return ascii_run_len_avx2;
+#endif
+#if defined(__SSE2__)
+	return ascii_run_len_sse2;
+#else
+	return ascii_run_len_scalar;
+#endif
 }
 
-void type_line(const string &raw_in, int lineno = -1, int total_lines = 0);
+static size_t (*const ascii_run_len)(const char *, size_t) = resolve_ascii_run_len();
 
-inline void maybe_bell(){
-	if(beep_on_error){
-		cerr << '\a' << flush;
+// Skips up to `want` newlines at p; returns the bytes consumed and lowers want.
+static size_t newline_skip_scalar(const char *p, size_t n, uint64_t &want){
+	size_t i = 0;
+	while(want > 0 && i < n){
+		const char *nl = (const char *)memchr(p + i, '\n', n - i);
+		if(!nl) return n;
+		i = (size_t)(nl - p) + 1;
+		--want;
 	}
+	return i;
 }
 
-void print_error_and_exit(int code, const string &msg){
-	string prefix = string("\x1B[31m") + "error (" + to_string(code) + "):" + "\x1B[0m";
-	string formatted = prefix + " " + msg;
+// Offset just past the want-th set bit of a block mask known to hold it.
+static inline size_t newline_mask_pick(uint64_t mask, uint64_t want){
+	while(--want) mask &= mask - 1;
+	return (size_t)__builtin_ctzll(mask) + 1;
+}
 
-	bool old_esc = escapes;
-	bool old_print_esc = print_escapes;
-	escapes = true;
-	print_escapes = false;
+#if defined(__SSE2__)
+static size_t newline_skip_sse2(const char *p, size_t n, uint64_t &want){
+	size_t i = 0;
+	const __m128i nl = _mm_set1_epi8('\n');
+	while(want > 0 && i + 64 <= n){
+		uint64_t mask = 0;
+		for(int k = 0; k < 4; ++k){
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + i + k * 16));
+			mask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (k * 16);
+		}
+		uint64_t found = (uint64_t)__builtin_popcountll(mask);
+		if(found >= want){
+			i += newline_mask_pick(mask, want);
+			want = 0;
+			return i;
+		}
+		want -= found;
+		i += 64;
+	}
+	return i + newline_skip_scalar(p + i, n - i, want);
+}
+#endif
 
-	maybe_bell();
-	print_show_cursor();
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2,popcnt")))
+static size_t newline_skip_avx2(const char *p, size_t n, uint64_t &want){
+	size_t i = 0;
+	const __m256i nl = _mm256_set1_epi8('\n');
+	while(want > 0 && i + 64 <= n){
+		__m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+		uint64_t mask = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl))
+			| (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl)) << 32;
+		uint64_t found = (uint64_t)__builtin_popcountll(mask);
+		if(found >= want){
+			i += newline_mask_pick(mask, want);
+			want = 0;
+			return i;
+		}
+		want -= found;
+		i += 64;
+	}
+	return i + newline_skip_scalar(p + i, n - i, want);
+}
+#endif
 
-	cerr << formatted << '\n' << flush;
+static size_t (*resolve_newline_skip())(const char *, size_t, uint64_t &){
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) return newline_skip_avx2;
+#endif
+#if defined(__SSE2__)
+	return newline_skip_sse2;
+#else
+	return newline_skip_scalar;
+#endif
+}
 
-	escapes = old_esc;
-	print_escapes = old_print_esc;
+static size_t (*const newline_skip)(const char *, size_t, uint64_t &) = resolve_newline_skip();
 
-	_exit(code);
+// Counts control bytes in p[0..n); stops at the first NUL and returns its index.
+static size_t binary_scan_tail(const char *p, size_t i, size_t n, uint64_t &suspicious, size_t &first){
+	for(; i < n; ++i){
+		unsigned char c = (unsigned char)p[i];
+		if(c >= 0x20 || (c >= 0x09 && c <= 0x0D)) continue;
+		if(first == SIZE_MAX) first = i;
+		if(c == 0) return i;
+		++suspicious;
+	}
+	return n;
 }
 
-void print_codes_and_exit(){
-	cout << "Exit codes and signals handled by typecat:\n\n";
-	cout << "Standard exit codes:\n";
-	cout << "  0   - OK\n";
-	cout << "  1   - Output is not a TTY (cannot pipe/redirect)\n";
-	cout << "  2   - Invalid speed parameter (use 1-100)\n";
-	cout << "  3   - Invalid mistakes parameter (use 1-100)\n";
-	cout << "  4   - Input appears to be binary (stdin). Use -a/--show-all to override.\n";
-	cout << "  5   - File cannot be read (permission denied / cannot open)\n";
-	cout << "  6   - Unknown option / bad parameter / option conflict\n";
-	cout << "  7   - Other runtime error\n";
-	cout << "  8   - File does not exist\n";
-	cout << "  9   - File is empty\n";
-	cout << " 10   - File appears to be binary (file). Use -a/--show-all to override.\n\n";
-	cout << "Signals (program exits with 128 + signal number unless allow-resize is enabled for SIGWINCH):\n";
-	cout << "  SIGINT	(2)  -> exit 130   - Interrupted by user (Ctrl-C)\n";
-	cout << "  SIGTERM	(15) -> exit 143   - Termination request\n";
-	cout << "  SIGQUIT	(3)  -> exit 131   - Quit from keyboard\n";
-	cout << "  SIGHUP	(1)  -> exit 129   - Hangup detected on controlling terminal\n";
-#ifdef SIGWINCH
-	cout << "  SIGWINCH (" << SIGWINCH << ") -> exit " << (128 + SIGWINCH)
-		 << "	- Window size change; by default the program will print a signal line and an error indicating that resizing during typing is not advised, then exit.\n"
-		 << "		Use -r/--allow-resize to ignore resize events.\n";
-#else
-	cout << "  SIGWINCH -> window-size change (handled if available on platform)\n";
+#if !defined(__SSE2__)
+static size_t binary_scan_scalar(const char *p, size_t n, uint64_t &suspicious, size_t &first){
+	return binary_scan_tail(p, 0, n, suspicious, first);
+}
 #endif
-	exit(0);
+
+#if defined(__SSE2__)
+static size_t binary_scan_sse2(const char *p, size_t n, uint64_t &suspicious, size_t &first){
+	size_t i = 0;
+	const __m128i neg = _mm_set1_epi8(-1);
+	const __m128i tab = _mm_set1_epi8(0x09);
+	const __m128i cr = _mm_set1_epi8(0x0D);
+	const __m128i sp = _mm_set1_epi8(0x20);
+	const __m128i zero = _mm_setzero_si128();
+	while(i + 16 <= n){
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i low = _mm_and_si128(_mm_cmpgt_epi8(v, neg), _mm_cmplt_epi8(v, tab));
+		__m128i mid = _mm_and_si128(_mm_cmpgt_epi8(v, cr), _mm_cmplt_epi8(v, sp));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(low, mid));
+		if(mask){
+			if(first == SIZE_MAX) first = i + (size_t)__builtin_ctz(mask);
+			unsigned nul = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+			if(nul){
+				unsigned at = (unsigned)__builtin_ctz(nul);
+				suspicious += (uint64_t)__builtin_popcount(mask & ((1u << at) - 1));
+				return i + at;
+			}
+			suspicious += (uint64_t)__builtin_popcount(mask);
+		}
+		i += 16;
+	}
+	return binary_scan_tail(p, i, n, suspicious, first);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2,popcnt")))
+static size_t binary_scan_avx2(const char *p, size_t n, uint64_t &suspicious, size_t &first){
+	size_t i = 0;
+	const __m256i neg = _mm256_set1_epi8(-1);
+	const __m256i tab = _mm256_set1_epi8(0x09);
+	const __m256i cr = _mm256_set1_epi8(0x0D);
+	const __m256i sp = _mm256_set1_epi8(0x20);
+	const __m256i zero = _mm256_setzero_si256();
+	while(i + 32 <= n){
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i low = _mm256_and_si256(_mm256_cmpgt_epi8(v, neg), _mm256_cmpgt_epi8(tab, v));
+		__m256i mid = _mm256_and_si256(_mm256_cmpgt_epi8(v, cr), _mm256_cmpgt_epi8(sp, v));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(low, mid));
+		if(mask){
+			if(first == SIZE_MAX) first = i + (size_t)__builtin_ctz(mask);
+			unsigned nul = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+			if(nul){
+				unsigned at = (unsigned)__builtin_ctz(nul);
+				suspicious += (uint64_t)__builtin_popcount(mask & ((1u << at) - 1));
+				return i + at;
+			}
+			suspicious += (uint64_t)__builtin_popcount(mask);
+		}
+		i += 32;
+	}
+	return binary_scan_tail(p, i, n, suspicious, first);
+}
+#endif
+
+static size_t (*resolve_binary_scan_run())(const char *, size_t, uint64_t &, size_t &){
+#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) return binary_scan_avx2;
+#endif
+#if defined(__SSE2__)
+	return binary_scan_sse2;
+#else
+	return binary_scan_scalar;
+#endif
+}
+
+static size_t (*const binary_scan_run)(const char *, size_t, uint64_t &, size_t &) = resolve_binary_scan_run();
+
+// Running binary verdict for one input: a NUL, or over 30% control bytes.
+struct binary_scan {
+	uint64_t scanned = 0;
+	uint64_t suspicious = 0;
+	uint64_t first = UINT64_MAX; // first suspicious byte
+	uint64_t nul = UINT64_MAX;
+	long long ns = 0;
+};
+
+bool binary_scan_done(const binary_scan &bs){
+	return bs.nul != UINT64_MAX || (binary_window > 0 && bs.scanned >= binary_window);
+}
+
+void binary_scan_feed(binary_scan &bs, string_view data){
+	if(binary_scan_done(bs)) return;
+	long long t0 = mono_now_ns();
+	size_t n = data.size();
+	if(binary_window > 0) n = (size_t)min((uint64_t)n, binary_window - bs.scanned);
+	size_t first = SIZE_MAX;
+	size_t stop = binary_scan_run(data.data(), n, bs.suspicious, first);
+	if(first != SIZE_MAX && bs.first == UINT64_MAX) bs.first = bs.scanned + first;
+	if(stop < n) bs.nul = bs.scanned + stop;
+	bs.scanned += stop < n ? stop + 1 : n;
+	bs.ns += mono_now_ns() - t0;
+}
+
+bool binary_scan_verdict(const binary_scan &bs){
+	return bs.nul != UINT64_MAX || bs.suspicious * 10 > bs.scanned * 3;
+}
+
+// Feeds a later chunk; if it turns the input binary, returns how much may still be typed.
+size_t binary_scan_check(binary_scan &bs, string_view chunk, bool strict, bool &turned){
+	uint64_t before = bs.scanned;
+	bool was_binary = binary_scan_verdict(bs);
+	binary_scan_feed(bs, chunk);
+	if(!strict || was_binary || !binary_scan_verdict(bs)) return chunk.size();
+	turned = true;
+	return bs.nul != UINT64_MAX ? (size_t)(bs.nul - before) : 0;
+}
+
+// " (NUL at byte N)" and the like, for error messages.
+string binary_scan_reason(const binary_scan &bs){
+	if(bs.nul != UINT64_MAX) return " (NUL at byte " + to_string(bs.nul) + ")";
+	return " (" + to_string(bs.suspicious) + " of " + to_string(bs.scanned) + " bytes are control characters)";
+}
+
+void print_binary_scan(const binary_scan &bs){
+	string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
+	cerr << dbg_prefix << " binary scan bytes=" << bs.scanned << " suspicious=" << bs.suspicious << " first=";
+	if(bs.first == UINT64_MAX) cerr << "none"; else cerr << bs.first;
+	cerr << " nul=";
+	if(bs.nul == UINT64_MAX) cerr << "none"; else cerr << bs.nul;
+	cerr << " verdict=" << (binary_scan_verdict(bs) ? "binary" : "text") << " in " << (double)bs.ns / 1e6 << "ms" << endl;
+}
+
+// Non-owning glyph iterator: offset, byte length and width of each glyph.
+struct glyph_ref {
+	size_t offset = 0;
+	int bytes = 0;
+	int width = 0;
+};
+
+struct glyph_cursor {
+	string_view s;
+	size_t pos = 0;
+	size_t ascii_end = 0;
+	bool done() const { return pos >= s.size(); }
+	glyph_ref next(){
+		glyph_ref g;
+		g.offset = pos;
+		if(pos >= ascii_end){
+			unsigned char c = (unsigned char)s[pos];
+			if(c >= 0x20 && c <= 0x7E) ascii_end = pos + ascii_run_len(s.data() + pos, s.size() - pos);
+		}
+		if(pos < ascii_end){
+			g.bytes = 1;
+			g.width = 1;
+			++pos;
+			return g;
+		}
+		uint32_t cp = utf8_decode_codepoint(s, pos, g.bytes);
+		if(g.bytes <= 0) g.bytes = 1;
+		g.width = unicode_wcwidth(cp);
+		pos += (size_t)g.bytes;
+		return g;
+	}
+};
+
+// Length of the escape sequence starting at s[i] (an ESC). complete is false
+// when the line ends before the sequence is terminated.
+static size_t escape_sequence_len(string_view s, size_t i, bool &complete){
+	size_t n = s.size();
+	size_t k = i + 1;
+	complete = false;
+	if(k >= n) return k - i;
+	char next = s[k++];
+	if(next == '['){
+		while(k < n){
+			unsigned char c = (unsigned char)s[k++];
+			if(c >= 0x40 && c <= 0x7E){ complete = true; break; }
+		}
+	} else if(next == ']'){
+		while(k < n){
+			char c = s[k++];
+			if(c == '\a'){ complete = true; break; }
+			if(c == '\x1B' && k < n && s[k] == '\\'){ ++k; complete = true; break; }
+		}
+	} else {
+		complete = true;
+	}
+	return k - i;
+}
+
+char pick_neighbor(char ch){
+	const key_neighbors &k = keyboard->key[(unsigned char)ch];
+	if(k.count == 0) return ch;
+	return k.n[rng_below(k.count)];
+}
+
+bool is_mistake(){
+	if(MISTAKE_CHANCE <= 0) return false;
+	int r = 1 + (int)rng_below(100);
+	if(r <= MISTAKE_CHANCE) return true;
+	typing_wait(1);
+	return false;
+}
+
+// Output frames: built in one preallocated buffer and sent with a single write().
+struct output_stats {
+	unsigned long long writes = 0;
+	unsigned long long bytes = 0;
+	unsigned long long glyphs = 0;
+};
+
+output_stats out_stats;
+static const size_t FRAME_CAP = 64 * 1024;
+static char frame_buf[FRAME_CAP];
+static size_t frame_len = 0;
+static size_t frame_block_at = SIZE_MAX;
+static bool output_broken = false;
+
+static void write_all(const char *p, size_t n){
+	if(estimate_only){
+		out_stats.writes++;
+		out_stats.bytes += (unsigned long long)n;
+		return;
+	}
+	while(n > 0 && !output_broken){
+		ssize_t w = write(STDOUT_FILENO, p, n);
+		out_stats.writes++;
+		if(w < 0){
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				struct pollfd pfd{};
+				pfd.fd = STDOUT_FILENO;
+				pfd.events = POLLOUT;
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			// The terminal is gone (EIO/EPIPE); drop output like a failed stream would.
+			output_broken = true;
+			break;
+		}
+		out_stats.bytes += (unsigned long long)w;
+		p += w;
+		n -= (size_t)w;
+	}
+}
+
+void frame_flush(){
+	frame_block_at = SIZE_MAX;
+	if(frame_len == 0) return;
+	write_all(frame_buf, frame_len);
+	frame_len = 0;
+}
+
+void frame_put(const char *p, size_t n){
+	if(frame_len + n > FRAME_CAP){
+		frame_flush();
+		if(n > FRAME_CAP){ write_all(p, n); return; }
+	}
+	memcpy(frame_buf + frame_len, p, n);
+	frame_len += n;
+}
+
+void frame_put(const string &s){ frame_put(s.data(), s.size()); }
+void frame_put(char c){ frame_put(&c, 1); }
+
+// CSI <col+1> G, formatted without touching the heap.
+void frame_put_col(int col){
+	char tmp[16];
+	int k = (int)sizeof(tmp);
+	unsigned v = (unsigned)(col + 1);
+	tmp[--k] = 'G';
+	do { tmp[--k] = (char)('0' + v % 10); v /= 10; } while(v > 0);
+	tmp[--k] = '[';
+	tmp[--k] = '\x1B';
+	frame_put(tmp + k, sizeof(tmp) - (size_t)k);
+}
+
+static const char BLOCK[] = "█";
+static const size_t BLOCK_LEN = sizeof(BLOCK) - 1;
+
+// --fps pacing: steps due before the frame's tick join the frame.
+struct frame_pacer {
+	long long interval_ns = 0;
+	long long base_ns = 0;
+	long long sent_ns = 0;
+	long long slowest_ns = 0;
+	int quick_frames = 0;
+	unsigned long long frames = 0;
+};
+
+frame_pacer pacer;
+
+void frame_pacer_init(int fps){
+	pacer.base_ns = pacer.interval_ns = pacer.slowest_ns = 1000000000LL / fps;
+}
+
+// A render step ends here: sent at once unless --fps is batching steps.
+void frame_commit(){
+	if(pacer.interval_ns == 0) frame_flush();
+}
+
+// Marks the block just appended so frame_reopen() can drop it.
+void frame_mark_block(){
+	frame_block_at = frame_len - BLOCK_LEN;
+}
+
+void frame_reopen(int col){
+	if(frame_block_at != SIZE_MAX && frame_block_at + BLOCK_LEN == frame_len){
+		frame_len = frame_block_at;
+		frame_block_at = SIZE_MAX;
+		return;
+	}
+	frame_block_at = SIZE_MAX;
+	frame_put_col(col);
+}
+
+bool frame_hold(long long due_ns){
+	if(pacer.interval_ns == 0 || frame_len == 0) return false;
+	long long tick = pacer.sent_ns + pacer.interval_ns;
+	if(due_ns < tick) return true;
+	long long start = tick;
+	if(!virtual_clock){
+		sleep_until_ns(tick);
+		start = mono_now_ns();
+	}
+	frame_flush();
+	pacer.frames++;
+	if(virtual_clock){
+		pacer.sent_ns = start;
+		return false;
+	}
+	long long end = mono_now_ns();
+	pacer.sent_ns = end;
+	if(end - start > pacer.interval_ns / 2){
+		if(pacer.interval_ns < 1000000000LL / 4) pacer.interval_ns *= 2;
+		if(pacer.interval_ns > pacer.slowest_ns) pacer.slowest_ns = pacer.interval_ns;
+		pacer.quick_frames = 0;
+	} else if(pacer.interval_ns > pacer.base_ns && ++pacer.quick_frames * pacer.interval_ns >= 1000000000LL){
+		pacer.interval_ns = max(pacer.base_ns, pacer.interval_ns * 3 / 4);
+		pacer.quick_frames = 0;
+	}
+	return false;
+}
+
+void print_hide_cursor(){ frame_put("\x1B[?25l", 6); frame_flush(); }
+void print_show_cursor(){ frame_put("\x1B[?25h", 6); frame_flush(); }
+
+void print_output_stats(){
+	string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
+	unsigned long long g = out_stats.glyphs > 0 ? out_stats.glyphs : 1;
+	cerr << dbg_prefix << " output writes=" << out_stats.writes << " bytes=" << out_stats.bytes
+		 << " glyphs=" << out_stats.glyphs << " writes/glyph=" << (double)out_stats.writes / (double)g
+		 << " bytes/glyph=" << (double)out_stats.bytes / (double)g << endl;
+	if(pacer.base_ns > 0){
+		cerr << dbg_prefix << " frames paced=" << pacer.frames << " fps cap=" << fps_cap
+			 << " now=" << 1000000000LL / pacer.interval_ns << " lowest=" << 1000000000LL / pacer.slowest_ns << endl;
+	}
+}
+
+void print_help(const string &prog_base){
+	cout << prog_base << " v1.1 (c) Kamil BuriXon Burek 2026\n\n";
+	cout << "Usage:\n";
+	cout << "  " << prog_base << " [options] [file]\n\n";
+	cout << "Options:\n";
+	cout << "  -s, --speed <1-100>       Typing speed (default 50). 100 = minimal delay.\n";
+	cout << "  -m, --mistakes <1-100>    Enable random mistakes. Optionally set chance 1-100 (default off|10).\n";
+	cout << "  --layout <name>           Keyboard for typo neighbours: qwerty (default),\n";
+	cout << "                            qwertz, azerty, dvorak, pl (Polish programmer).\n";
+	cout << "  -c, --color               Interpret ANSI escape sequences (emit colors).\n";
+	cout << "  -e, --print-escapes       Print ANSI escapes textually as \\e[..., not as colors.\n";
+	cout << "                            (conflicts with -c/--color)\n";
+	cout << "  --seed <n>                Seed the delay/typo generator; same seed and input\n";
+	cout << "                            give identical timing (reproducible demos).\n";
+	cout << "  -b, --beep                Emit BEL on non-zero exit code.\n";
+	cout << "  -t, --text <string>       Add a text line to display (can be repeated).\n";
+	cout << "  -a, --show-all            Force showing input even if detected as binary.\n";
+	cout << "  --binary-window <size>    Bytes checked for binary content: a count with optional\n";
+	cout << "                            k/m/g suffix, or all (default). Stops at the first NUL.\n";
+	cout << "                            Typing starts after the first 1 MiB of a file is checked;\n";
+	cout << "                            the rest is checked as it is typed.\n";
+	cout << "  -n, --line-numbers        Prepend dimmed line numbers (N| ) to each line.\n";
+	cout << "  -r, --allow-resize        Allow terminal resize (SIGWINCH) during typing; the row\n";
+	cout << "                            being typed is re-wrapped to the new width.\n";
+	cout << "  --duration <seconds>      Fit the whole input into this wall-clock time (file or -t\n";
+	cout << "                            input). Overrides the per-glyph delay scale of --speed.\n";
+	cout << "  --fps <1-1000>            Cap screen updates per second; glyphs due within one\n";
+	cout << "                            frame go out together. Lowered automatically while the\n";
+	cout << "                            terminal falls behind.\n";
+	cout << "  -j, --jobs <1-256>        Threads preparing file/-t lines ahead of typing (default 1).\n";
+	cout << "  --from-line <n>           Start at line n of the file or piped input (1-based).\n";
+	cout << "  --to-line <n>             Stop after line n. -t lines are not part of the range.\n";
+	cout << "  --lines <a:b>             Same as --from-line a --to-line b; either side may be empty.\n";
+	cout << "  -f, --follow              Type the file, then keep typing what is appended to it\n";
+	cout << "                            (follows truncation and rotation, like tail -F).\n";
+	cout << "  --follow-new              Like -f/--follow but type only content added from now on.\n";
+	cout << "  --index                   Keep the file's newline index in <file>.tcidx and reuse it,\n";
+	cout << "                            so later seeks skip straight to the range.\n";
+	cout << "  --virtual-clock           Run against simulated time: no sleeping, no TTY needed.\n";
+	cout << "                            Prints duration, glyphs and bytes to stderr at the end.\n";
+	cout << "  --estimate                Like --virtual-clock but prints only the predicted run time.\n";
+	cout << "  -h, --help                Show this help and exit.\n";
+	cout << "  -v, --version             Show program version and exit.\n";
+	cout << "  --codes                   Show a list of exit codes and signal handling details.\n\n";
+	cout << "Input:\n";
+	cout << "  If no file is provided and stdin is a TTY, program reads lines as you\n";
+	cout << "  type them (press Enter to send a line). If stdin is piped, lines are\n";
+	cout << "  typed as they arrive, so endless producers (tail -f) work too.\n\n";
+	cout << "License: GPLv3.0\n";
+}
+
+void print_version(const string &prog_base){
+	cout << prog_base << " v1.1 (c) Kamil BuriXon Burek 2026\n";
+}
+
+inline void maybe_bell(){
+	if(beep_on_error){
+		cerr << '\a' << flush;
+	}
+}
+
+void print_error_and_exit(int code, const string &msg){
+	string prefix = string("\x1B[31m") + "error (" + to_string(code) + "):" + "\x1B[0m";
+	string formatted = prefix + " " + msg;
+
+	bool old_esc = escapes;
+	bool old_print_esc = print_escapes;
+	escapes = true;
+	print_escapes = false;
+
+	maybe_bell();
+	print_show_cursor();
+
+	cerr << formatted << '\n' << flush;
+
+	escapes = old_esc;
+	print_escapes = old_print_esc;
+
+	_exit(code);
+}
+
+void print_codes_and_exit(){
+	cout << "Exit codes and signals handled by typecat:\n\n";
+	cout << "Standard exit codes:\n";
+	cout << "  0   - OK\n";
+	cout << "  1   - Output is not a TTY (cannot pipe/redirect; allowed with --virtual-clock/--estimate)\n";
+	cout << "  2   - Invalid speed parameter (use 1-100)\n";
+	cout << "  3   - Invalid mistakes parameter (use 1-100)\n";
+	cout << "  4   - Input appears to be binary (stdin). Use -a/--show-all to override.\n";
+	cout << "  5   - File cannot be read (permission denied / cannot open)\n";
+	cout << "  6   - Unknown option / bad parameter / option conflict\n";
+	cout << "  7   - Other runtime error\n";
+	cout << "  8   - File does not exist\n";
+	cout << "  9   - File is empty\n";
+	cout << " 10   - File appears to be binary (file). Use -a/--show-all to override.\n\n";
+	cout << "Signals (program exits with 128 + signal number unless allow-resize is enabled for SIGWINCH):\n";
+	cout << "  SIGINT	(2)  -> exit 130   - Interrupted by user (Ctrl-C)\n";
+	cout << "  SIGTERM	(15) -> exit 143   - Termination request\n";
+	cout << "  SIGQUIT	(3)  -> exit 131   - Quit from keyboard\n";
+	cout << "  SIGHUP	(1)  -> exit 129   - Hangup detected on controlling terminal\n";
+	cout << "  SIGBUS	(" << SIGBUS << ")  -> exit 7     - Input file shrank while mapped (the cursor is restored)\n";
+#ifdef SIGWINCH
+	cout << "  SIGWINCH (" << SIGWINCH << ") -> exit " << (128 + SIGWINCH)
+		 << "	- Window size change; by default the program will print a signal line and an error indicating that resizing during typing is not advised, then exit.\n"
+		 << "		Use -r/--allow-resize to keep typing; the row in progress is re-wrapped to the new width.\n";
+#else
+	cout << "  SIGWINCH -> window-size change (handled if available on platform)\n";
+#endif
+	exit(0);
 }
 
 void handle_signal_event(int signo){
@@ -469,286 +1437,1426 @@ void handle_signal_event(int signo){
 	cerr << sig_prefix << " " << (desc ? desc : "") << endl;
 	maybe_bell();
 
-	_exit(exit_code);
+	_exit(exit_code);
+}
+
+void signal_handler(int signo){
+#ifdef SIGWINCH
+	if(signo == SIGWINCH) cols_dirty = 1;
+#endif
+	sig_flag = signo;
+	if(sig_pipe_fds[1] != -1){
+		uint8_t b = 1;
+		ssize_t r = write(sig_pipe_fds[1], &b, 1);
+		(void)r;
+	}
+}
+
+// Last resort for a mapped file truncated between the size check and the
+// access: bring the cursor back and exit 7. Only async-signal-safe calls.
+void sigbus_handler(int){
+	static const char show[] = "\x1B[?25h\n";
+	static const char msg[] = "\x1B[31merror (7):\x1B[0m Input file shrank while it was being read (SIGBUS)\n";
+	ssize_t r = write(STDOUT_FILENO, show, sizeof(show) - 1);
+	r = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	(void)r;
+	_exit(7);
+}
+
+void drain_sig_pipe(){
+	if(sig_pipe_fds[0] == -1) return;
+	uint8_t buf[128];
+	while(true){
+		ssize_t r = read(sig_pipe_fds[0], buf, sizeof(buf));
+		if(r <= 0) break;
+	}
+}
+
+void event_loop_init();
+
+void install_signal_handlers(){
+	if(pipe(sig_pipe_fds) != 0){
+		sig_pipe_fds[0] = sig_pipe_fds[1] = -1;
+	} else {
+		int flags = fcntl(sig_pipe_fds[0], F_GETFL, 0);
+		fcntl(sig_pipe_fds[0], F_SETFL, flags | O_NONBLOCK);
+		flags = fcntl(sig_pipe_fds[1], F_GETFL, 0);
+		fcntl(sig_pipe_fds[1], F_SETFL, flags | O_NONBLOCK);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+	sigaction(SIGQUIT, &sa, nullptr);
+	sigaction(SIGHUP, &sa, nullptr);
+#ifdef SIGWINCH
+	sigaction(SIGWINCH, &sa, nullptr);
+#endif
+	sa.sa_handler = sigbus_handler;
+	sigaction(SIGBUS, &sa, nullptr);
+	// A closed pipe (--virtual-clock | head) shows up as EPIPE in write_all().
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, nullptr);
+	event_loop_init();
+}
+
+static bool fd_readable_now(int fd){
+	struct pollfd pfd{};
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0;
+}
+
+// Event loop: epoll over signalfd, timerfd and input; poll() on the self-pipe elsewhere.
+struct event_loop {
+	int ep = -1;
+	int sfd = -1;
+	int tfd = -1;
+	int input_fd = -1;
+	bool input_polled = false;
+};
+
+event_loop evloop;
+
+void event_loop_init(){
+#ifdef __linux__
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGWINCH);
+	evloop.ep = epoll_create1(EPOLL_CLOEXEC);
+	evloop.sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	evloop.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	bool ok = evloop.ep != -1 && evloop.sfd != -1 && evloop.tfd != -1;
+	if(ok){
+		struct epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.fd = evloop.sfd;
+		ok = epoll_ctl(evloop.ep, EPOLL_CTL_ADD, evloop.sfd, &ev) == 0;
+		ev.data.fd = evloop.tfd;
+		ok = ok && epoll_ctl(evloop.ep, EPOLL_CTL_ADD, evloop.tfd, &ev) == 0;
+	}
+	if(ok) ok = sigprocmask(SIG_BLOCK, &mask, nullptr) == 0;
+	if(!ok){
+		if(evloop.ep != -1) close(evloop.ep);
+		if(evloop.sfd != -1) close(evloop.sfd);
+		if(evloop.tfd != -1) close(evloop.tfd);
+		evloop = event_loop();
+	}
+#endif
+}
+
+// Moves pending signalfd signals into sig_flag without blocking. With the
+// handlers in charge (no signalfd) there is nothing to collect.
+bool event_poll_signals(){
+	bool any = false;
+#ifdef __linux__
+	if(evloop.sfd == -1) return false;
+	struct signalfd_siginfo si;
+	while(read(evloop.sfd, &si, sizeof(si)) == (ssize_t)sizeof(si)){
+		int signo = (int)si.ssi_signo;
+		if(signo == SIGWINCH) cols_dirty = 1;
+		// A pending resize must not hide a termination request.
+		if(signo != SIGWINCH || !sig_flag) sig_flag = signo;
+		any = true;
+	}
+#endif
+	return any;
+}
+
+// Drops fd from the epoll set before it is closed, so a reused number is watched again.
+void event_forget(int fd){
+#ifdef __linux__
+	if(fd == -1 || fd != evloop.input_fd) return;
+	if(evloop.input_polled) epoll_ctl(evloop.ep, EPOLL_CTL_DEL, fd, nullptr);
+	evloop.input_fd = -1;
+	evloop.input_polled = false;
+#else
+	(void)fd;
+#endif
+}
+
+#ifdef __linux__
+static int event_wait_epoll(long long deadline_ns, int input_fd){
+	if(input_fd != evloop.input_fd){
+		if(evloop.input_fd != -1 && evloop.input_polled){
+			epoll_ctl(evloop.ep, EPOLL_CTL_DEL, evloop.input_fd, nullptr);
+		}
+		evloop.input_fd = input_fd;
+		evloop.input_polled = false;
+		if(input_fd != -1){
+			struct epoll_event ev{};
+			ev.events = EPOLLIN;
+			ev.data.fd = input_fd;
+			// Regular files and some devices cannot be watched (EPERM); they
+			// never block, so report them as ready right away.
+			evloop.input_polled = epoll_ctl(evloop.ep, EPOLL_CTL_ADD, input_fd, &ev) == 0;
+		}
+	}
+	if(input_fd != -1 && !evloop.input_polled) return EV_INPUT;
+
+	struct itimerspec its{};
+	if(deadline_ns >= 0){
+		// An all-zero it_value would disarm the timer instead of firing it.
+		if(deadline_ns == 0) deadline_ns = 1;
+		its.it_value.tv_sec = (time_t)(deadline_ns / 1000000000LL);
+		its.it_value.tv_nsec = (long)(deadline_ns % 1000000000LL);
+	}
+	timerfd_settime(evloop.tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+
+	struct epoll_event evs[3];
+	int n;
+	do {
+		n = epoll_wait(evloop.ep, evs, 3, -1);
+	} while(n < 0 && errno == EINTR);
+	if(n < 0) print_error_and_exit(7, string("epoll_wait() failed: ") + strerror(errno));
+
+	int result = 0;
+	for(int k = 0; k < n; ++k){
+		int fd = evs[k].data.fd;
+		if(fd == evloop.sfd){
+			if(event_poll_signals()) result |= EV_SIGNAL;
+		} else if(fd == evloop.tfd){
+			uint64_t expirations;
+			if(read(evloop.tfd, &expirations, sizeof(expirations)) > 0) result |= EV_TIMER;
+		} else if(fd == input_fd){
+			result |= EV_INPUT;
+		}
+	}
+	return result;
+}
+#endif
+
+// Waits for deadline_ns, input_fd or a signal; returns EV_* bits.
+int event_wait(long long deadline_ns, int input_fd){
+#ifdef __linux__
+	if(evloop.ep != -1) return event_wait_epoll(deadline_ns, input_fd);
+#endif
+	struct pollfd pfd[2]{};
+	int nfds = 0;
+	int pipe_idx = -1, input_idx = -1;
+	if(sig_pipe_fds[0] != -1){
+		pipe_idx = nfds;
+		pfd[nfds].fd = sig_pipe_fds[0];
+		pfd[nfds++].events = POLLIN;
+	}
+	if(input_fd != -1){
+		input_idx = nfds;
+		pfd[nfds].fd = input_fd;
+		pfd[nfds++].events = POLLIN;
+	}
+	long long left = -1;
+	if(deadline_ns >= 0){
+		left = deadline_ns - mono_now_ns();
+		if(left <= 0) return EV_TIMER;
+	}
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+	struct timespec ts{};
+	ts.tv_sec = (time_t)(left / 1000000000LL);
+	ts.tv_nsec = (long)(left % 1000000000LL);
+	int rc = ppoll(pfd, (nfds_t)nfds, left >= 0 ? &ts : nullptr, nullptr);
+#else
+	int rc = poll(pfd, (nfds_t)nfds, left >= 0 ? (int)((left + 999999) / 1000000) : -1);
+#endif
+	if(rc < 0){
+		if(errno != EINTR) print_error_and_exit(7, string("poll() failed: ") + strerror(errno));
+		return sig_flag ? EV_SIGNAL : 0;
+	}
+	int result = 0;
+	if(pipe_idx != -1 && (pfd[pipe_idx].revents & POLLIN)){
+		drain_sig_pipe();
+		result |= EV_SIGNAL;
+	}
+	if(input_idx != -1 && (pfd[input_idx].revents & (POLLIN|POLLERR|POLLHUP))) result |= EV_INPUT;
+	if(deadline_ns >= 0 && mono_now_ns() >= deadline_ns) result |= EV_TIMER;
+	return result;
+}
+
+// Waits until fd has data (or EOF) to read, handling signals meanwhile.
+void wait_readable(int fd){
+	while(!fd_readable_now(fd)){
+		if(event_wait(-1, fd) & EV_SIGNAL){
+			if(sig_flag){
+				int signo = sig_flag;
+				sig_flag = 0;
+				handle_signal_event(signo);
+			}
+		}
+	}
+}
+
+int digits_count(int x){
+	if(x <= 0) return 1;
+	return (int)floor(log10((double)x)) + 1;
+}
+
+// Layout plan for one line: steps in parallel arrays, wrapped per width.
+enum : uint8_t {
+	STEP_GLYPH,   // printable, never mistyped (space, multibyte)
+	STEP_KEY,     // single-byte key that may be mistyped
+	STEP_TAB,
+	STEP_ESCAPE,  // complete escape sequence, written without a delay
+	STEP_SKIP     // unterminated escape or C0 control, dropped
+};
+
+struct line_plan {
+	vector<uint32_t> offset;
+	vector<uint32_t> len;
+	vector<uint8_t> advance;
+	vector<uint8_t> cls;
+	vector<uint32_t> breaks;
+	size_t size() const { return offset.size(); }
+};
+
+static void plan_push(line_plan &p, size_t offset, size_t len, int advance, uint8_t cls){
+	p.offset.push_back((uint32_t)offset);
+	p.len.push_back((uint32_t)len);
+	p.advance.push_back((uint8_t)advance);
+	p.cls.push_back(cls);
+}
+
+void plan_line(line_plan &p, string_view line){
+	p.offset.clear();
+	p.len.clear();
+	p.advance.clear();
+	p.cls.clear();
+	p.breaks.clear();
+	// CRLF input: the '\r' would send the cursor back over the row.
+	if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
+	glyph_cursor gc{line};
+	while(!gc.done()){
+		if(escapes && (unsigned char)line[gc.pos] == 0x1B){
+			bool complete = false;
+			size_t n = escape_sequence_len(line, gc.pos, complete);
+			// An unterminated sequence can only run to the end of the line; drop it
+			// instead of leaving the terminal parser waiting for a final byte.
+			plan_push(p, gc.pos, n, 0, complete ? STEP_ESCAPE : STEP_SKIP);
+			gc.pos += n;
+			continue;
+		}
+		glyph_ref g = gc.next();
+		char c = line[g.offset];
+		uint8_t cls = STEP_GLYPH;
+		if(g.bytes == 1 && c == '\t') cls = STEP_TAB;
+		else if(g.bytes == 1 && ((unsigned char)c < 0x20 || c == 0x7F)) cls = STEP_SKIP;
+		else if(g.bytes == 1 && c != ' ') cls = STEP_KEY;
+		plan_push(p, g.offset, (size_t)g.bytes, g.width, cls);
+	}
+}
+
+// Lays out steps from `from` on for a cols-wide terminal, recording row breaks.
+void plan_wrap(line_plan &p, size_t from, int col, int cols, int prefix_len){
+	p.breaks.erase(lower_bound(p.breaks.begin(), p.breaks.end(), (uint32_t)from), p.breaks.end());
+	for(size_t k = from; k < p.size(); ++k){
+		if(p.cls[k] == STEP_TAB){
+			int delta = TABSIZE - col % TABSIZE;
+			p.advance[k] = (uint8_t)delta;
+			if(col + delta >= cols){
+				p.breaks.push_back((uint32_t)k);
+				col = prefix_len;
+			} else {
+				col += delta;
+			}
+		} else if(p.cls[k] == STEP_GLYPH || p.cls[k] == STEP_KEY){
+			// A zero-width step belongs to the glyph before it and never wraps.
+			if(p.advance[k] > 0 && col + p.advance[k] >= cols){
+				p.breaks.push_back((uint32_t)k);
+				col = prefix_len;
+			}
+			col += p.advance[k];
+		}
+	}
+}
+
+static size_t plan_next_break(const line_plan &p, size_t step){
+	return (size_t)(lower_bound(p.breaks.begin(), p.breaks.end(), (uint32_t)step) - p.breaks.begin());
+}
+
+// Incremental row renderer: each step sends only a column move, the glyph and a new block.
+struct row_renderer {
+	string prefix_full;
+	string prefix_cont;
+	string gutter_cont;
+	int prefix_len = 0;
+	int gutter_len = 0;
+	int col = 0;
+	int cols = 0;
+	size_t row_start = 0;
+	bool first_row = true;
+};
+
+void render_begin(row_renderer &r, const string &prefix_full, const string &prefix_cont, int prefix_len){
+	r.prefix_full = prefix_full;
+	r.prefix_cont = r.gutter_cont = prefix_cont;
+	r.prefix_len = r.gutter_len = prefix_len;
+	r.col = prefix_len;
+	r.cols = get_cols();
+	r.row_start = 0;
+	r.first_row = true;
+	frame_put("\r\x1B[K", 4);
+	frame_put(prefix_full);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_mark_block();
+	frame_commit();
+}
+
+void render_glyph(row_renderer &r, const char *bytes, size_t n, int width){
+	frame_reopen(r.col);
+	frame_put(bytes, n);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_mark_block();
+	frame_commit();
+	// A zero-width glyph (combining mark, ZWJ, variation selector) joins the
+	// cell before it; the block goes back where it was.
+	r.col += width;
+	out_stats.glyphs++;
+}
+
+void render_tab(row_renderer &r, int delta){
+	static const char spaces[] = "                ";
+	frame_reopen(r.col);
+	frame_put(spaces, (size_t)min(delta, (int)sizeof(spaces) - 1));
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_mark_block();
+	frame_commit();
+	r.col += delta;
+	out_stats.glyphs++;
+}
+
+void render_escape(row_renderer &r, const char *bytes, size_t n){
+	frame_put_col(r.col);
+	frame_put(bytes, n);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_commit();
+}
+
+// next_step: the plan step that starts the new screen row.
+void render_wrap(row_renderer &r, size_t next_step){
+	frame_put_col(r.col);
+	frame_put("\x1B[K\n", 4);
+	frame_put(r.prefix_cont);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_mark_block();
+	frame_commit();
+	r.col = r.prefix_len;
+	r.row_start = next_step;
+	r.first_row = false;
+}
+
+void render_typo(row_renderer &r, char wrong){
+	frame_put_col(r.col);
+	frame_put(wrong);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_commit();
+}
+
+void render_untypo(row_renderer &r){
+	frame_put_col(r.col);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_put("\x1B[K", 3);
+	frame_commit();
+}
+
+void render_end(row_renderer &r){
+	frame_put_col(r.col);
+	frame_put("\x1B[K\n", 4);
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_commit();
+}
+
+void render_clear_row(){
+	frame_put("\r\x1B[K", 4);
+	frame_commit();
+}
+
+// The gutter is dropped while the terminal is too narrow to hold it next to
+// a wide glyph and the cursor block.
+static void render_fit_gutter(row_renderer &r, int cols){
+	bool fits = r.gutter_len + 3 <= cols;
+	r.prefix_cont = fits ? r.gutter_cont : string();
+	r.prefix_len = fits ? r.gutter_len : 0;
+}
+
+static void reflow_break(row_renderer &r, size_t next_step){
+	frame_put("\x1B[K\n", 4);
+	frame_put(r.prefix_cont);
+	r.col = r.prefix_len;
+	r.row_start = next_step;
+	r.first_row = false;
+}
+
+// Width changed under -r: re-wrap and redraw only the row in progress.
+void render_reflow(row_renderer &r, string_view line, line_plan &p, size_t end, int cols){
+	static const char spaces[] = "                ";
+	r.cols = cols;
+	render_fit_gutter(r, cols);
+	plan_wrap(p, r.row_start, r.prefix_len, cols, r.prefix_len);
+	frame_put("\r\x1B[J", 4);
+	if(r.prefix_len > 0) frame_put(r.first_row ? r.prefix_full : r.prefix_cont);
+	r.col = r.prefix_len;
+
+	size_t b = plan_next_break(p, r.row_start);
+	for(size_t k = r.row_start; k < end; ++k){
+		bool brk = b < p.breaks.size() && p.breaks[b] == k;
+		if(brk) ++b;
+		const char *bytes = line.data() + p.offset[k];
+		switch(p.cls[k]){
+			case STEP_ESCAPE:
+				frame_put(bytes, p.len[k]);
+				break;
+			case STEP_TAB:
+				if(brk){
+					reflow_break(r, k + 1);
+				} else {
+					frame_put(spaces, (size_t)min((int)p.advance[k], (int)sizeof(spaces) - 1));
+					r.col += p.advance[k];
+				}
+				break;
+			case STEP_GLYPH:
+			case STEP_KEY:
+				if(brk) reflow_break(r, k);
+				frame_put(bytes, p.len[k]);
+				r.col += p.advance[k];
+				break;
+			default:
+				break;
+		}
+	}
+	frame_put(BLOCK, BLOCK_LEN);
+	frame_mark_block();
+	frame_commit();
+}
+
+// Plays back one line that the reader thread already normalized and planned.
+void type_line(const string &line, line_plan &plan, int lineno, int total_lines){
+	if(debug_enabled){
+		string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
+		cerr << dbg_prefix << " typing line";
+		if(lineno >= 1) cerr << " " << lineno << "/" << (total_lines > 0 ? total_lines : lineno);
+		cerr << " cols=" << get_cols() << " speed=" << speed << " allow-resize=" << (allow_resize ? "ON" : "OFF")
+			 << " binary=" << (input_is_binary ? "YES" : "NO") << endl;
+	}
+
+	string prefix_full_str;
+	string prefix_cont_str;
+	int prefix_visible_len = 0;
+	if(line_numbers && lineno >= 1){
+		int width = digits_count(total_lines > 0 ? total_lines : max(1, lineno));
+		string visible;
+		if(input_is_binary){
+			string q(width - 1, ' ');
+			q += '?';
+			visible = q + "| ";
+		} else {
+			string num = to_string(lineno);
+			if((int)num.size() < width) num = string(width - (int)num.size(), ' ') + num;
+			visible = num + "| ";
+		}
+		prefix_visible_len = (int)visible.size();
+		prefix_full_str = string("\x1B[2m") + visible + "\x1B[0m";
+		prefix_cont_str = string("\x1B[2m") + string(width, ' ') + "| " + "\x1B[0m";
+	}
+
+	row_renderer rr;
+	render_begin(rr, prefix_full_str, prefix_cont_str, prefix_visible_len);
+	plan_wrap(plan, 0, rr.col, rr.cols, rr.prefix_len);
+
+	size_t next_break = 0;
+	for(size_t k = 0; k < plan.size(); ++k){
+		if(sig_flag){
+			int signo = sig_flag;
+			sig_flag = 0;
+			handle_signal_event(signo);
+		}
+
+		uint8_t cls = plan.cls[k];
+		const char *bytes = line.data() + plan.offset[k];
+		if(cls == STEP_SKIP) continue;
+		if(cls == STEP_ESCAPE){
+			render_escape(rr, bytes, plan.len[k]);
+			continue;
+		}
+
+		typing_wait(cls == STEP_TAB ? 6 : 3);
+		if(allow_resize){
+			int cols = get_cols();
+			if(cols != rr.cols){
+				render_reflow(rr, line, plan, k, cols);
+				next_break = plan_next_break(plan, k);
+			}
+		}
+
+		if(next_break < plan.breaks.size() && plan.breaks[next_break] == k){
+			++next_break;
+			render_wrap(rr, cls == STEP_TAB ? k + 1 : k);
+			typing_wait(2);
+			if(cls == STEP_TAB) continue;
+		} else if(cls == STEP_TAB){
+			render_tab(rr, plan.advance[k]);
+			continue;
+		}
+
+		if(cls == STEP_KEY && mistakes && is_mistake()){
+			char wrong = pick_neighbor(*bytes);
+			render_typo(rr, wrong);
+			typing_wait(5);
+			render_untypo(rr);
+			typing_wait(10);
+		}
+
+		render_glyph(rr, bytes, plan.len[k], plan.advance[k]);
+	}
+
+	render_end(rr);
+	typing_wait(6);
+	render_clear_row();
+
+	if(debug_enabled){
+		string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
+		cerr << dbg_prefix << " finished line";
+		if(lineno >= 1) cerr << " " << lineno;
+		cerr << " cols=" << get_cols() << " speed=" << speed << endl;
+	}
+}
+
+// Summary of a --virtual-clock run; --estimate prints just the duration.
+void print_virtual_summary(){
+	double secs = (double)tclock.planned_ns / 1e9;
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.3f", secs);
+	if(estimate_only){
+		cout << buf << "s" << endl;
+		return;
+	}
+	cerr << "virtual-clock: duration=" << buf << "s glyphs=" << out_stats.glyphs
+		 << " bytes=" << out_stats.bytes << " writes=" << out_stats.writes << endl;
+}
+
+void print_finish_debug(){
+	print_output_stats();
+	print_timing_stats();
+	string success_prefix = string("\x1B[32m") + "success (0):" + "\x1B[0m";
+	cout << success_prefix << " " << "work finished successfully! (allow-resize: " << (allow_resize ? "ENABLED" : "DISABLED") << ")" << endl;
+}
+
+// File input: regular files are mmap()ed and walked lazily, others read in chunks.
+struct file_source {
+	int fd = -1;
+	const char *map = nullptr;
+	size_t map_len = 0;
+	size_t pos = 0;
+	string buf;
+	bool eof = false;
+	// Set while the reader thread owns the source: reads block plainly and a
+	// failure is recorded here instead of exiting from that thread.
+	bool on_reader = false;
+	int read_errno = 0;
+	// binary_stop: reading ended early because the input turned binary.
+	binary_scan scan;
+	bool binary_stop = false;
+	// Line range: lines consumed so far, where reading stops and where rewinding goes.
+	uint64_t line_no = 0;
+	uint64_t line_end = UINT64_MAX;
+	size_t start_pos = 0;
+	uint64_t start_line = 0;
+	// The mapping after the file shrank; only unmapped on close.
+	const char *dropped_map = nullptr;
+	size_t dropped_len = 0;
+	// Mapped bytes up to scan_end are classified; those before scanned_to
+	// already are. map_stop: where reading ends once the input turned binary.
+	size_t scanned_to = 0;
+	size_t scan_end = 0;
+	size_t map_stop = SIZE_MAX;
+};
+
+// A mapped file gets its verdict on the first BINARY_PRESCAN bytes; the rest
+// is scanned BINARY_SCAN_AHEAD bytes at a time as its lines are read.
+static const size_t BINARY_PRESCAN = 1 << 20;
+static const size_t BINARY_SCAN_AHEAD = 1 << 16;
+
+bool file_source_open(file_source &src, const string &path){
+	src.fd = open(path.c_str(), O_RDONLY);
+	if(src.fd < 0) return false;
+	struct stat st{};
+	if(fstat(src.fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+		void *m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, src.fd, 0);
+		if(m != MAP_FAILED){
+			src.map = (const char *)m;
+			src.map_len = (size_t)st.st_size;
+			madvise(m, src.map_len, MADV_SEQUENTIAL);
+		}
+	}
+	return true;
+}
+
+void file_source_close(file_source &src){
+	if(src.map) munmap((void *)src.map, src.map_len);
+	if(src.dropped_map) munmap((void *)src.dropped_map, src.dropped_len);
+	event_forget(src.fd);
+	if(src.fd >= 0) close(src.fd);
+	src.map = nullptr;
+	src.fd = -1;
+}
+
+// Reads one more chunk into the fallback buffer; false once at EOF.
+static bool file_source_fill(file_source &src){
+	if(src.eof) return false;
+	char chunk[65536];
+	while(true){
+		if(!src.on_reader) wait_readable(src.fd);
+		ssize_t r = read(src.fd, chunk, sizeof(chunk));
+		if(r < 0){
+			if(src.on_reader){
+				if(errno == EINTR) continue;
+				src.read_errno = errno;
+				src.eof = true;
+				return false;
+			}
+			if(errno == EINTR){
+				if(sig_flag){
+					int signo = sig_flag;
+					sig_flag = 0;
+					handle_signal_event(signo);
+				}
+				continue;
+			}
+			print_error_and_exit(7, string("read() failed: ") + strerror(errno));
+		}
+		if(r == 0){ src.eof = true; return false; }
+		bool turned_binary = false;
+		size_t take = binary_scan_check(src.scan, string_view(chunk, (size_t)r), src.on_reader && !show_all, turned_binary);
+		src.buf.append(chunk, take);
+		if(turned_binary){
+			// The line cut short by the verdict is not typed.
+			size_t nl = src.buf.rfind('\n');
+			src.buf.resize(nl == string::npos || nl < src.pos ? src.pos : nl + 1);
+			src.eof = true;
+			src.binary_stop = true;
+		}
+		return take > 0;
+	}
+}
+
+// First bytes of the input (up to want) without consuming them.
+string_view file_source_window(file_source &src, size_t want){
+	if(src.map) return string_view(src.map, min(want, src.map_len));
+	while(src.buf.size() - src.pos < want && file_source_fill(src)){}
+	return string_view(src.buf.data() + src.pos, min(want, src.buf.size() - src.pos));
+}
+
+// Leaves the mapping for read()s once the file is shorter than mapped.
+static void file_source_check_size(file_source &src){
+	struct stat st{};
+	if(fstat(src.fd, &st) != 0 || (size_t)st.st_size >= src.map_len) return;
+	lseek(src.fd, (off_t)src.pos, SEEK_SET);
+	src.dropped_map = src.map;
+	src.dropped_len = src.map_len;
+	src.map = nullptr;
+	src.map_len = 0;
+	src.pos = 0;
+	src.buf.clear();
+}
+
+// Classifies the mapped bytes up to at least upto. If they turn the input
+// binary, reading stops after the last complete line before the cut.
+static void file_source_scan_ahead(file_source &src, size_t upto){
+	size_t to = min(max(upto, src.scanned_to + BINARY_SCAN_AHEAD), src.scan_end);
+	bool turned = false;
+	size_t take = binary_scan_check(src.scan, string_view(src.map + src.scanned_to, to - src.scanned_to), src.on_reader && !show_all, turned);
+	if(turned){
+		size_t stop = src.scanned_to + take;
+		while(stop > src.pos && src.map[stop - 1] != '\n') --stop;
+		src.map_stop = stop;
+		src.binary_stop = true;
+	}
+	src.scanned_to = to;
+}
+
+static bool file_source_read_line(file_source &src, string_view &line){
+	if(src.map) file_source_check_size(src);
+	if(src.map){
+		if(src.pos >= src.map_len || src.pos >= src.map_stop) return false;
+		const char *p = src.map + src.pos;
+		size_t left = src.map_len - src.pos;
+		const char *nl = (const char *)memchr(p, '\n', left);
+		size_t n = nl ? (size_t)(nl - p) : left;
+		size_t end = src.pos + n + (nl ? 1 : 0);
+		if(end > src.scanned_to && src.scanned_to < src.scan_end){
+			file_source_scan_ahead(src, end);
+			if(src.pos >= src.map_stop) return false;
+		}
+		line = string_view(p, n);
+		src.pos += n + (nl ? 1 : 0);
+		return true;
+	}
+	while(true){
+		size_t nl = src.buf.find('\n', src.pos);
+		if(nl != string::npos){
+			line = string_view(src.buf.data() + src.pos, nl - src.pos);
+			src.pos = nl + 1;
+			return true;
+		}
+		if(src.pos > 0){
+			src.buf.erase(0, src.pos);
+			src.pos = 0;
+		}
+		if(!file_source_fill(src)){
+			if(src.buf.empty()) return false;
+			line = string_view(src.buf.data(), src.buf.size());
+			src.pos = src.buf.size();
+			return true;
+		}
+	}
+}
+
+// The returned view stays valid until the next call.
+bool file_source_next(file_source &src, string_view &line){
+	if(src.line_no >= src.line_end || !file_source_read_line(src, line)) return false;
+	++src.line_no;
+	return true;
+}
+
+void file_source_rewind(file_source &src){
+	if(src.dropped_map){
+		lseek(src.fd, (off_t)src.start_pos, SEEK_SET);
+		src.pos = 0;
+		src.buf.clear();
+		src.eof = false;
+	} else {
+		src.pos = src.start_pos;
+	}
+	src.line_no = src.start_line;
+}
+
+// Binary verdict before typing, from the first bytes of the file.
+void file_source_classify(file_source &src, size_t from, size_t to){
+	if(src.map){
+		src.scanned_to = from + min(to - from, BINARY_PRESCAN);
+		src.scan_end = to;
+		binary_scan_feed(src.scan, string_view(src.map + from, src.scanned_to - from));
+	}
+	if(debug_enabled) print_binary_scan(src.scan);
+	bool binary = binary_scan_verdict(src.scan);
+	if(binary && !show_all){
+		print_error_and_exit(10, "File appears to be binary" + binary_scan_reason(src.scan) + ". Use -a/--show-all to force display.");
+	}
+	input_is_binary = binary;
+}
+
+// Newline index: line count and every LINE_INDEX_STRIDE-th offset, kept in <file>.tcidx with --index.
+static const uint64_t LINE_INDEX_STRIDE = 1024;
+static const char LINE_INDEX_MAGIC[8] = {'T', 'C', 'I', 'D', 'X', '0', '1', '\n'};
+
+struct line_index {
+	uint64_t lines = 0;
+	vector<uint64_t> marks; // marks[k]: offset of line k * LINE_INDEX_STRIDE (0-based)
+	const char *origin = "none";
+};
+
+struct line_index_header {
+	char magic[8];
+	uint64_t size, ino, dev, mtime_sec, mtime_nsec;
+	uint64_t stride, lines, marks;
+};
+
+void line_index_build(line_index &ix, const char *map, size_t len){
+	ix.lines = 0;
+	ix.marks.assign(1, 0);
+	size_t pos = 0;
+	while(pos < len){
+		uint64_t want = LINE_INDEX_STRIDE;
+		pos += newline_skip(map + pos, len - pos, want);
+		ix.lines += LINE_INDEX_STRIDE - want;
+		if(want == 0 && pos < len) ix.marks.push_back(pos);
+	}
+	// Like getline(): an unterminated last line still counts.
+	if(len > 0 && map[len - 1] != '\n') ++ix.lines;
+	ix.origin = "built";
+}
+
+static line_index_header line_index_stamp(const struct stat &st){
+	line_index_header h{};
+	memcpy(h.magic, LINE_INDEX_MAGIC, sizeof(h.magic));
+	h.size = (uint64_t)st.st_size;
+	h.ino = (uint64_t)st.st_ino;
+	h.dev = (uint64_t)st.st_dev;
+#if defined(__APPLE__)
+	h.mtime_sec = (uint64_t)st.st_mtimespec.tv_sec;
+	h.mtime_nsec = (uint64_t)st.st_mtimespec.tv_nsec;
+#elif defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+	h.mtime_sec = (uint64_t)st.st_mtim.tv_sec;
+	h.mtime_nsec = (uint64_t)st.st_mtim.tv_nsec;
+#else
+	// Seconds only; size and inode still catch most rewrites.
+	h.mtime_sec = (uint64_t)st.st_mtime;
+#endif
+	h.stride = LINE_INDEX_STRIDE;
+	return h;
 }
 
-void signal_handler(int signo){
-	sig_flag = signo;
-	if(sig_pipe_fds[1] != -1){
-		uint8_t b = 1;
-		ssize_t r = write(sig_pipe_fds[1], &b, 1);
-		(void)r;
+static bool read_full(int fd, void *data, size_t n){
+	char *p = (char *)data;
+	while(n > 0){
+		ssize_t r = read(fd, p, n);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		p += r;
+		n -= (size_t)r;
 	}
+	return true;
 }
 
-void drain_sig_pipe(){
-	if(sig_pipe_fds[0] == -1) return;
-	uint8_t buf[128];
-	while(true){
-		ssize_t r = read(sig_pipe_fds[0], buf, sizeof(buf));
-		if(r <= 0) break;
+static bool write_full(int fd, const void *data, size_t n){
+	const char *p = (const char *)data;
+	while(n > 0){
+		ssize_t w = write(fd, p, n);
+		if(w < 0 && errno == EINTR) continue;
+		if(w <= 0) return false;
+		p += w;
+		n -= (size_t)w;
 	}
+	return true;
 }
 
-void install_signal_handlers(){
-	if(pipe(sig_pipe_fds) != 0){
-		sig_pipe_fds[0] = sig_pipe_fds[1] = -1;
-	} else {
-		int flags = fcntl(sig_pipe_fds[0], F_GETFL, 0);
-		fcntl(sig_pipe_fds[0], F_SETFL, flags | O_NONBLOCK);
-		flags = fcntl(sig_pipe_fds[1], F_GETFL, 0);
-		fcntl(sig_pipe_fds[1], F_SETFL, flags | O_NONBLOCK);
+// Loads a saved index if it still describes the open file.
+bool line_index_load(line_index &ix, const file_source &src, const string &path){
+	struct stat st{};
+	if(fstat(src.fd, &st) != 0) return false;
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	line_index_header want = line_index_stamp(st), h{};
+	bool ok = read_full(fd, &h, sizeof(h))
+		&& memcmp(&h, &want, offsetof(line_index_header, lines)) == 0
+		&& h.marks >= 1 && h.marks <= h.size / LINE_INDEX_STRIDE + 1;
+	if(ok){
+		ix.marks.resize(h.marks);
+		ok = read_full(fd, ix.marks.data(), h.marks * sizeof(uint64_t)) && ix.marks[0] == 0 && ix.marks.back() < h.size;
 	}
+	close(fd);
+	if(!ok) return false;
+	ix.lines = h.lines;
+	ix.origin = "loaded";
+	return true;
+}
 
-	struct sigaction sa;
-	memset(&sa, 0, sizeof(sa));
-	sa.sa_handler = signal_handler;
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = 0;
-	sigaction(SIGINT, &sa, nullptr);
-	sigaction(SIGTERM, &sa, nullptr);
-	sigaction(SIGQUIT, &sa, nullptr);
-	sigaction(SIGHUP, &sa, nullptr);
-#ifdef SIGWINCH
-	sigaction(SIGWINCH, &sa, nullptr);
-#endif
+// Best effort: a read-only directory just means the index is rebuilt next time.
+void line_index_save(line_index &ix, const file_source &src, const string &path){
+	struct stat st{};
+	if(fstat(src.fd, &st) != 0) return;
+	line_index_header h = line_index_stamp(st);
+	h.lines = ix.lines;
+	h.marks = ix.marks.size();
+	// mkstemp() creates the temp file exclusively, so a planted symlink or
+	// file under that name is never written through.
+	string tmp = path + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if(fd < 0) return;
+	mode_t mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0644 & ~mask);
+	bool ok = write_full(fd, &h, sizeof(h)) && write_full(fd, ix.marks.data(), ix.marks.size() * sizeof(uint64_t));
+	if(close(fd) != 0) ok = false;
+	if(ok && rename(tmp.c_str(), path.c_str()) == 0){
+		ix.origin = "built+saved";
+		return;
+	}
+	unlink(tmp.c_str());
 }
 
-int digits_count(int x){
-	if(x <= 0) return 1;
-	return (int)floor(log10((double)x)) + 1;
+// Byte offset of 0-based line `line`, or map_len past the last line. An
+// empty index scans from the start of the file.
+size_t line_index_offset(const line_index &ix, const file_source &src, uint64_t line){
+	uint64_t k = ix.marks.empty() ? 0 : min(line / LINE_INDEX_STRIDE, (uint64_t)ix.marks.size() - 1);
+	size_t pos = ix.marks.empty() ? 0 : (size_t)ix.marks[k];
+	uint64_t want = line - k * LINE_INDEX_STRIDE;
+	pos += newline_skip(src.map + pos, src.map_len - pos, want);
+	return want > 0 ? src.map_len : pos;
 }
 
-void sanitize_trailing_esc(string &s){
-	size_t n = s.size();
-	if(n == 0) return;
-	size_t pos = s.find_last_of('\x1B');
-	if(pos == string::npos) return;
-	size_t i = pos + 1;
-	if(i >= n){
-		s.erase(pos);
-		return;
-	}
-	unsigned char next = (unsigned char)s[i];
-	if(next == '['){
-		bool terminator_found = false;
-		for(size_t k = i+1; k < n; ++k){
-			unsigned char cc = (unsigned char)s[k];
-			if(cc >= 0x40 && cc <= 0x7E){ terminator_found = true; break; }
-		}
-		if(!terminator_found){ s.erase(pos); return; }
-	} else if(next == ']'){
-		bool terminator_found = false;
-		for(size_t k = i+1; k < n; ++k){
-			if(s[k] == '\a'){ terminator_found = true; break; }
-			if(s[k] == 0x1B && (k+1) < n && s[k+1] == '\\'){ terminator_found = true; break; }
-		}
-		if(!terminator_found){ s.erase(pos); return; }
+// Restricts the source to lines first..last (1-based, last 0 = to the end).
+void file_source_select(file_source &src, const line_index &ix, uint64_t first, uint64_t last){
+	if(src.map){
+		src.pos = line_index_offset(ix, src, first - 1);
+		src.line_no = first - 1;
 	} else {
-		return;
+		string_view skipped;
+		while(src.line_no < first - 1 && file_source_next(src, skipped)){}
 	}
+	if(last > 0) src.line_end = last;
+	src.start_pos = src.pos;
+	src.start_line = src.line_no;
 }
 
-void type_line(const string &raw_in, int lineno, int total_lines){
-	string raw = raw_in;
-	string line;
+// Reader thread -> SPSC ring of prepared lines -> renderer (main thread).
+static const size_t RING_SLOTS = 64;
+static const size_t RING_SLOT_KEEP = 1 << 20;
+
+struct line_slot {
+	string_view raw;
+	string raw_copy;
+	string text;
+	line_plan plan;
+	int lineno = -1;
+	int total = 0;
+	int error = 0;
+	string message;
+};
 
-	if(print_escapes){
-		string tmp = raw;
-		replace_all(tmp, "\\e", string(1, '\x1B'));
-		replace_all(tmp, "\\x1b", string(1, '\x1B'));
-		replace_all(tmp, "\\033", string(1, '\x1B'));
-		line = render_escapes_as_text(tmp);
-	} else if(escapes){
-		line = raw;
-		replace_all(line, "\\e", string(1, '\x1B'));
-		replace_all(line, "\\x1b", string(1, '\x1B'));
-		replace_all(line, "\\033", string(1, '\x1B'));
-	} else {
-		line = strip_ansi(raw);
-		replace_all(line, "\\e", "");
-		replace_all(line, "\\x1b", "");
-		replace_all(line, "\\033", "");
-	}
+struct line_ring {
+	vector<line_slot> slots;
+	size_t cap = 0;
+	atomic<size_t> head{0};
+	atomic<size_t> tail{0};
+	atomic<bool> done{false};
+	int ready_fds[2] = {-1, -1};
+	int space_fds[2] = {-1, -1};
+};
 
-	if(debug_enabled){
-		string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
-		cerr << dbg_prefix << " typing line";
-		if(lineno >= 1) cerr << " " << lineno << "/" << (total_lines > 0 ? total_lines : lineno);
-		cerr << " cols=" << get_cols() << " speed=" << speed << " allow-resize=" << (allow_resize ? "ON" : "OFF")
-			 << " binary=" << (input_is_binary ? "YES" : "NO") << endl;
+static void ring_wake(int fd){
+	uint8_t b = 1;
+	ssize_t r = write(fd, &b, 1);
+	(void)r;
+}
+
+static void ring_drain(int fd){
+	uint8_t buf[64];
+	while(read(fd, buf, sizeof(buf)) > 0){}
+}
+
+static bool ring_open(line_ring &ring, size_t cap){
+	ring.slots.resize(cap);
+	ring.cap = cap;
+	if(pipe(ring.ready_fds) != 0) return false;
+	if(pipe(ring.space_fds) != 0){
+		close(ring.ready_fds[0]);
+		close(ring.ready_fds[1]);
+		return false;
 	}
+	for(int fd : {ring.ready_fds[0], ring.ready_fds[1], ring.space_fds[0], ring.space_fds[1]}){
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return true;
+}
 
-	string prefix_full_str;
-	string prefix_cont_str;
-	int prefix_visible_len = 0;
-	if(line_numbers && lineno >= 1){
-		int width = digits_count(total_lines > 0 ? total_lines : max(1, lineno));
-		string visible;
-		if(input_is_binary){
-			string q(width - 1, ' ');
-			q += '?';
-			visible = q + "| ";
-		} else {
-			string num = to_string(lineno);
-			if((int)num.size() < width) num = string(width - (int)num.size(), ' ') + num;
-			visible = num + "| ";
-		}
-		prefix_visible_len = (int)visible.size();
-		prefix_full_str = string("\x1B[2m") + visible + "\x1B[0m";
-		prefix_cont_str = string("\x1B[2m") + string(width, ' ') + "| " + "\x1B[0m";
+static void ring_close(line_ring &ring){
+	event_forget(ring.ready_fds[0]);
+	for(int fd : {ring.ready_fds[0], ring.ready_fds[1], ring.space_fds[0], ring.space_fds[1]}) close(fd);
+}
+
+static line_slot &ring_slot(line_ring &ring, size_t seq){
+	return ring.slots[seq % ring.cap];
+}
+
+// Reader side: waits until n slots past the tail are free and returns the
+// first; the reader owns them until ring_publish().
+static line_slot &ring_claim(line_ring &ring, size_t n = 1){
+	size_t tail = ring.tail.load(memory_order_relaxed);
+	while(tail + n - ring.head.load(memory_order_acquire) > ring.cap){
+		struct pollfd pfd{};
+		pfd.fd = ring.space_fds[0];
+		pfd.events = POLLIN;
+		poll(&pfd, 1, -1);
+		ring_drain(ring.space_fds[0]);
 	}
+	return ring_slot(ring, tail);
+}
 
-	string out;
-	int j = 0;
+static void ring_publish(line_ring &ring, size_t n = 1){
+	ring.tail.store(ring.tail.load(memory_order_relaxed) + n, memory_order_release);
+	ring_wake(ring.ready_fds[1]);
+}
 
-	if(prefix_visible_len > 0){
-		out = prefix_full_str;
-		j = prefix_visible_len;
+// Everything between reading a line and typing it, on slot.raw.
+static void prep_slot(line_slot &slot){
+	normalize_line(slot.raw, slot.text);
+	slot.error = 0;
+	if(slot.text.size() > UINT32_MAX){
+		slot.error = 7;
+		slot.message = "Line too long (over 4 GiB)";
 	} else {
-		out.clear();
-		j = 0;
+		plan_line(slot.plan, slot.text);
 	}
+}
 
-	int len = (int)line.size();
-	size_t i = 0;
-	while(i < (size_t)len){
+static void ring_set_numbers(line_slot &slot, int lineno, int total){
+	slot.lineno = line_numbers ? lineno : -1;
+	slot.total = line_numbers ? total : 0;
+}
+
+static void ring_push_line(line_ring &ring, string_view raw, int lineno, int total){
+	line_slot &slot = ring_claim(ring);
+	slot.raw = raw;
+	prep_slot(slot);
+	ring_set_numbers(slot, lineno, total);
+	ring_publish(ring);
+}
+
+static void ring_fail(line_ring &ring, int code, const string &msg){
+	line_slot &slot = ring_claim(ring);
+	slot.error = code;
+	slot.message = msg;
+	ring_publish(ring);
+}
+
+static void ring_finish(line_ring &ring){
+	ring.done.store(true, memory_order_release);
+	ring_wake(ring.ready_fds[1]);
+}
+
+// Starts the reader with our signals blocked, so the renderer takes them all.
+template<class F>
+static thread ring_start_reader(F &&body){
+	sigset_t mask, old;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGHUP);
+#ifdef SIGWINCH
+	sigaddset(&mask, SIGWINCH);
+#endif
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	thread t(std::forward<F>(body));
+	pthread_sigmask(SIG_SETMASK, &old, nullptr);
+	return t;
+}
+
+// Renderer side: types slots as they arrive until the reader is done.
+static void ring_type_lines(line_ring &ring, bool interactive){
+	while(true){
 		if(sig_flag){
 			int signo = sig_flag;
 			sig_flag = 0;
 			handle_signal_event(signo);
 		}
-
-		if(escapes && (unsigned char)line[i] == 0x1B){
-			string esc;
-			esc.push_back(line[i]);
-			++i;
-			if(i >= (size_t)len){ out += esc; cout << '\r' << "\x1B[K" << out << "█" << flush; break; }
-			char next = line[i++];
-			esc.push_back(next);
-			if(next == '['){
-				while(i < (size_t)len){
-					char c = line[i++];
-					esc.push_back(c);
-					if((unsigned char)c >= 0x40 && (unsigned char)c <= 0x7E) break;
-				}
-				out += esc; cout << '\r' << "\x1B[K" << out << "█" << flush; continue;
-			}
-			if(next == ']'){
-				while(i < (size_t)len){
-					char c = line[i++];
-					esc.push_back(c);
-					if(c == '\a') break;
-					if(c == '\x1B' && i < (size_t)len && line[i] == '\\'){ esc.push_back('\\'); ++i; break; }
-				}
-				out += esc; cout << '\r' << "\x1B[K" << out << "█" << flush; continue;
+		size_t head = ring.head.load(memory_order_relaxed);
+		if(head == ring.tail.load(memory_order_acquire)){
+			if(ring.done.load(memory_order_acquire) && head == ring.tail.load(memory_order_acquire)){
+				typing_finish();
+				break;
 			}
-			out += esc; cout << '\r' << "\x1B[K" << out << "█" << flush; continue;
+			typing_finish();
+			typing_clock_pause();
+			if(interactive) print_show_cursor();
+			if(event_wait(-1, ring.ready_fds[0]) & EV_INPUT) ring_drain(ring.ready_fds[0]);
+			continue;
 		}
+		line_slot &slot = ring_slot(ring, head);
+		if(slot.error) print_error_and_exit(slot.error, slot.message);
+		if(interactive) print_hide_cursor();
+		type_line(slot.text, slot.plan, slot.lineno, slot.total);
+		// Give back what a very long line made the slot grow to.
+		if(slot.text.capacity() > RING_SLOT_KEEP || slot.raw_copy.capacity() > RING_SLOT_KEEP){
+			string().swap(slot.text);
+			string().swap(slot.raw_copy);
+			slot.plan = line_plan();
+		}
+		ring.head.store(head + 1, memory_order_release);
+		ring_wake(ring.space_fds[1]);
+	}
+}
 
-		int char_bytes = 0;
-		int glyph_width = 0;
-		string glyph = utf8_next_glyph(line, i, char_bytes, glyph_width);
-		char ch0 = glyph[0];
+// --jobs: the reader and its helpers prepare each batch of slots in input order.
+static const size_t PREP_BATCH = 256;
+
+struct prep_pool {
+	vector<thread> helpers;
+	mutex m;
+	condition_variable wake;
+	condition_variable finished;
+	line_ring *ring = nullptr;
+	size_t first = 0;
+	size_t count = 0;
+	atomic<size_t> next{0};
+	unsigned long long batch = 0;
+	size_t busy = 0;
+	bool quit = false;
+};
 
-		if(char_bytes == 1 && ch0 == '\t'){
-			int mod = j % TABSIZE;
-			int delta = TABSIZE - mod;
-			if(delta == 0) delta = TABSIZE;
+static void prep_pool_work(prep_pool &p){
+	size_t i;
+	while((i = p.next.fetch_add(1)) < p.count) prep_slot(ring_slot(*p.ring, p.first + i));
+}
 
-			cout << '\r' << "\x1B[K" << out << "█" << flush;
-			for(int X=0; X<6; ++X){
-				if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-				this_thread::sleep_for(chrono::duration<double>(calc_delay()));
-			}
-			int prospective = j + delta;
-			int cols = get_cols();
-			if(prospective >= cols){
-				cout << '\r' << "\x1B[K" << out << '\n' << flush;
-				if(prefix_visible_len > 0){
-					out = prefix_cont_str;
-					cout << out << "█" << flush;
-					j = prefix_visible_len;
+static void prep_pool_helper(prep_pool &p){
+	unsigned long long seen = 0;
+	unique_lock<mutex> lk(p.m);
+	while(true){
+		p.wake.wait(lk, [&]{ return p.quit || p.batch != seen; });
+		if(p.quit) return;
+		seen = p.batch;
+		lk.unlock();
+		prep_pool_work(p);
+		lk.lock();
+		if(--p.busy == 0) p.finished.notify_one();
+	}
+}
+
+static void prep_pool_start(prep_pool &p, line_ring &ring, int threads){
+	p.ring = &ring;
+	for(int k = 1; k < threads; ++k) p.helpers.emplace_back(prep_pool_helper, std::ref(p));
+}
+
+static void prep_pool_run(prep_pool &p, size_t first, size_t count){
+	if(p.helpers.empty()){
+		for(size_t i = 0; i < count; ++i) prep_slot(ring_slot(*p.ring, first + i));
+		return;
+	}
+	{
+		lock_guard<mutex> lk(p.m);
+		p.first = first;
+		p.count = count;
+		p.next.store(0);
+		p.busy = p.helpers.size();
+		++p.batch;
+	}
+	p.wake.notify_all();
+	prep_pool_work(p);
+	unique_lock<mutex> lk(p.m);
+	p.finished.wait(lk, [&]{ return p.busy == 0; });
+}
+
+static void prep_pool_stop(prep_pool &p){
+	{
+		lock_guard<mutex> lk(p.m);
+		p.quit = true;
+	}
+	p.wake.notify_all();
+	for(thread &t : p.helpers) t.join();
+}
+
+// Types the -t texts and then the file. Gutter numbering runs across both.
+void type_all_lines(file_source &src, bool have_file, int total_lines, bool total_known){
+	line_ring ring;
+	size_t max_batch = jobs > 1 ? PREP_BATCH : 1;
+	if(!ring_open(ring, max(RING_SLOTS, max_batch * 4))) print_error_and_exit(7, string("pipe() failed: ") + strerror(errno));
+	src.on_reader = true;
+	thread reader = ring_start_reader([&](){
+		prep_pool pool;
+		prep_pool_start(pool, ring, jobs);
+		int lineno = 0;
+		size_t idx = 0;
+		size_t batch = 1;
+		while(true){
+			ring_claim(ring, batch);
+			size_t first = ring.tail.load(memory_order_relaxed);
+			size_t n = 0;
+			string_view line;
+			while(n < batch){
+				line_slot &slot = ring_slot(ring, first + n);
+				if(idx < texts.size()){
+					slot.raw = texts[idx++];
+					ring_set_numbers(slot, ++lineno, total_lines);
+				} else if(have_file && file_source_next(src, line)){
+					// Only a mapped file keeps its bytes in place until typed.
+					if(src.map){
+						slot.raw = line;
+					} else {
+						slot.raw_copy.assign(line.data(), line.size());
+						slot.raw = slot.raw_copy;
+					}
+					lineno = (int)(texts.size() + src.line_no);
+					ring_set_numbers(slot, lineno, total_known ? total_lines : lineno);
 				} else {
-					out.clear();
-					cout << "█" << flush;
-					j = 0;
-				}
-				for(int X=0; X<2; ++X){
-					if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-					this_thread::sleep_for(chrono::duration<double>(calc_delay()));
+					break;
 				}
-			} else {
-				j = prospective;
+				++n;
 			}
-			i += 1;
-			continue;
+			if(n == 0) break;
+			prep_pool_run(pool, first, n);
+			ring_publish(ring, n);
+			if(n < batch) break;
+			batch = min(batch * 2, max_batch);
 		}
-
-		cout << '\r' << "\x1B[K" << out << "█" << flush;
-		for(int X=0; X<3; ++X){
-			if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-			this_thread::sleep_for(chrono::duration<double>(calc_delay()));
+		prep_pool_stop(pool);
+		if(src.read_errno) ring_fail(ring, 7, string("read() failed: ") + strerror(src.read_errno));
+		if(src.binary_stop){
+			ring_fail(ring, 10, "File turned out to be binary" + binary_scan_reason(src.scan) + ". Use -a/--show-all to force display.");
 		}
+		ring_finish(ring);
+	});
+	ring_type_lines(ring, false);
+	reader.join();
+	src.on_reader = false;
+	ring_close(ring);
+}
 
-		int delta = glyph_width > 0 ? glyph_width : 1;
-		int prospective = j + delta;
-		int cols = get_cols();
+// Follow mode: wait on inotify at EOF and reopen after truncation or rotation.
+static const int FOLLOW_POLL_MS = 250;
 
-		if(prospective >= cols){
-			cout << '\r' << "\x1B[K" << out << '\n' << flush;
-			if(prefix_visible_len > 0){
-				out = prefix_cont_str;
-				cout << out << "█" << flush;
-				j = prefix_visible_len;
-			} else {
-				out.clear();
-				cout << "█" << flush;
-				j = 0;
-			}
-			for(int X=0; X<2; ++X){
-				if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-				this_thread::sleep_for(chrono::duration<double>(calc_delay()));
+enum { FOLLOW_DATA, FOLLOW_RESTART };
+
+struct follow_state {
+	string path;
+	string name;
+	int inotify_fd = -1;
+	int file_wd = -1;
+	// Lines before the first one typed (--follow-new), for numbering.
+	uint64_t first_line = 0;
+};
+
+void follow_open(follow_state &fs, const string &path){
+	fs.path = path;
+	size_t slash = path.find_last_of('/');
+	fs.name = slash == string::npos ? path : path.substr(slash + 1);
+#ifdef __linux__
+	string dir = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+	fs.inotify_fd = inotify_init1(IN_CLOEXEC);
+	if(fs.inotify_fd < 0) return;
+	fs.file_wd = inotify_add_watch(fs.inotify_fd, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	if(fs.file_wd < 0 || inotify_add_watch(fs.inotify_fd, dir.c_str(), IN_CREATE | IN_MOVED_TO) < 0){
+		close(fs.inotify_fd);
+		fs.inotify_fd = -1;
+	}
+#endif
+}
+
+// Sleeps until something may have happened to the file.
+static void follow_block(follow_state &fs){
+#ifdef __linux__
+	if(fs.inotify_fd >= 0){
+		alignas(struct inotify_event) char buf[4096];
+		while(true){
+			ssize_t r = read(fs.inotify_fd, buf, sizeof(buf));
+			if(r < 0 && errno == EINTR) continue;
+			if(r <= 0) break;
+			// Directory events for other names are not ours.
+			for(ssize_t off = 0; off < r;){
+				const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+				if(ev->wd == fs.file_wd || (ev->len > 0 && fs.name == ev->name)) return;
+				off += (ssize_t)(sizeof(struct inotify_event) + ev->len);
 			}
-		} else {
-			j = prospective;
 		}
+	}
+#endif
+	poll(nullptr, 0, FOLLOW_POLL_MS);
+}
 
-		if(mistakes && char_bytes == 1 && ch0 != '\n' && ch0 != ' ' && ch0 != '\t' && is_mistake()){
-			char wrong = pick_neighbor(ch0);
-			cout << '\r' << "\x1B[K" << out << wrong << "█" << flush;
-			for(int X=0; X<5; ++X){
-				if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-				this_thread::sleep_for(chrono::duration<double>(calc_delay()));
+// Called at EOF: waits until fd has more to read (FOLLOW_DATA), or until it
+// was truncated or replaced by a rotated file (FOLLOW_RESTART, fd updated).
+static int follow_wait(follow_state &fs, int &fd){
+	while(true){
+		struct stat st{}, named{};
+		off_t pos = lseek(fd, 0, SEEK_CUR);
+		if(fstat(fd, &st) == 0){
+			if(st.st_size > pos) return FOLLOW_DATA;
+			if(st.st_size < pos){
+				lseek(fd, 0, SEEK_SET);
+				return FOLLOW_RESTART;
 			}
-			cout << '\r' << "\x1B[K" << out << "█" << flush;
-			for(int X=0; X<10; ++X){
-				if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-				this_thread::sleep_for(chrono::duration<double>(calc_delay()));
+		}
+		if(stat(fs.path.c_str(), &named) == 0 && (named.st_ino != st.st_ino || named.st_dev != st.st_dev)){
+			int next = open(fs.path.c_str(), O_RDONLY | O_CLOEXEC);
+			if(next >= 0){
+				close(fd);
+				fd = next;
+#ifdef __linux__
+				if(fs.inotify_fd >= 0){
+					inotify_rm_watch(fs.inotify_fd, fs.file_wd);
+					fs.file_wd = inotify_add_watch(fs.inotify_fd, fs.path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+				}
+#endif
+				return FOLLOW_RESTART;
 			}
 		}
-
-		out.append(glyph);
-		cout << '\r' << "\x1B[K" << out << "█" << flush;
-		i += (size_t)char_bytes;
+		follow_block(fs);
 	}
+}
 
-	sanitize_trailing_esc(out);
-	cout << '\r' << "\x1B[K" << out << '\n' << flush;
+// Streaming reader: passes on complete lines as data arrives.
+static void stream_reader(line_ring &ring, int fd, bool interactive, follow_state *follow){
+	string partial;
+	int lineno = follow ? (int)follow->first_line : 0;
+	int number_base = follow ? (int)texts.size() : 0;
+	const int BUF_SIZE = 4096;
+	vector<char> buf(BUF_SIZE);
+	bool classified = interactive || follow;
+	binary_scan scan;
+	bool eof = false;
+
+	// False once the line range is complete.
+	auto emit = [&](string_view line){
+		++lineno;
+		if((uint64_t)lineno < from_line) return true;
+		ring_push_line(ring, line, lineno + number_base, lineno + number_base);
+		return to_line == 0 || (uint64_t)lineno < to_line;
+	};
+
+	while(!eof){
+		ssize_t r = read(fd, buf.data(), BUF_SIZE);
+		if(r < 0){
+			if(errno == EINTR) continue;
+			ring_fail(ring, 7, string("read() failed: ") + strerror(errno));
+			return;
+		}
+		if(r == 0 && follow){
+			if(follow_wait(*follow, fd) == FOLLOW_RESTART && !partial.empty()){
+				bool more = emit(partial);
+				partial.clear();
+				if(!more) break;
+			}
+			continue;
+		}
+		size_t take = r > 0 ? (size_t)r : 0;
+		bool turned_binary = false;
+		if(r == 0){
+			eof = true;
+		} else if(!interactive){
+			take = binary_scan_check(scan, string_view(buf.data(), take), classified && !show_all, turned_binary);
+		}
+		partial.append(buf.data(), buf.data() + take);
+
+		if(!classified){
+			if(!eof && partial.size() < (size_t)BUF_SIZE && fd_readable_now(fd)) continue;
+			if(debug_enabled) print_binary_scan(scan);
+			bool binary = binary_scan_verdict(scan);
+			if(binary && !show_all){
+				ring_fail(ring, 4, "Input appears to be binary" + binary_scan_reason(scan) + ". Use -a/--show-all to force display.");
+				return;
+			}
+			input_is_binary = binary;
+			classified = true;
+		}
 
-	cout << "█" << flush;
-	for(int X=0; X<6; ++X){
-		if(sig_flag){ int signo = sig_flag; sig_flag = 0; handle_signal_event(signo); }
-		this_thread::sleep_for(chrono::duration<double>(calc_delay()));
+		size_t start = 0;
+		size_t pos;
+		bool more = true;
+		while(more && (pos = partial.find('\n', start)) != string::npos){
+			string_view line(partial.data() + start, pos - start);
+			start = pos + 1;
+			if(interactive && !line.empty() && line.back() == '\r') line.remove_suffix(1);
+			more = emit(line);
+		}
+		if(!more) break;
+		partial.erase(0, start);
+		if(turned_binary){
+			ring_fail(ring, follow ? 10 : 4, string(follow ? "File" : "Input") + " turned out to be binary" + binary_scan_reason(scan) + ". Use -a/--show-all to force display.");
+			return;
+		}
 	}
-	cout << '\r' << "\x1B[K" << flush;
 
-	if(debug_enabled){
-		string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
-		cerr << dbg_prefix << " finished line";
-		if(lineno >= 1) cerr << " " << lineno;
-		cerr << " cols=" << get_cols() << " speed=" << speed << endl;
-	}
+	if(eof && !interactive && !partial.empty()) emit(partial);
+	ring_finish(ring);
+}
+
+// Types lines from fd as they arrive; shared by the interactive TTY path,
+// piped stdin and follow mode.
+void stream_lines(int fd, bool interactive, follow_state *follow = nullptr){
+	line_ring ring;
+	if(!ring_open(ring, RING_SLOTS)) print_error_and_exit(7, string("pipe() failed: ") + strerror(errno));
+	if(!interactive) print_hide_cursor();
+	thread reader = ring_start_reader([&](){ stream_reader(ring, fd, interactive, follow); });
+	ring_type_lines(ring, interactive);
+	reader.join();
+	ring_close(ring);
 }
 
 int main(int argc, char **argv){
@@ -770,10 +2878,6 @@ int main(int argc, char **argv){
 		if(sig_pipe_fds[1] != -1) close(sig_pipe_fds[1]);
 	});
 
-	if(!isatty(STDOUT_FILENO) || !isatty(STDERR_FILENO)){
-		print_error_and_exit(1, "Output cannot be piped or redirected. (FD: 1/2)");
-	}
-
 	vector<string> args;
 	for(int i=1;i<argc;++i) args.push_back(string(argv[i]));
 
@@ -808,13 +2912,104 @@ int main(int argc, char **argv){
 		} else if(a=="-b" || a=="--beep"){
 			beep_on_error = true;
 		} else if(a=="-t" || a=="--text"){
-			if(idx+1<args.size()){ texts.push_back(args[++idx]); } else { texts.push_back(string()); }
+			if(idx+1<args.size()){ texts.push_back(args[++idx]); } else { texts.push_back(string_view()); }
 		} else if(a=="-a" || a=="--show-all"){
 			show_all = true;
 		} else if(a=="-n" || a=="--line-numbers"){
 			line_numbers = true;
 		} else if(a=="-r" || a=="--allow-resize"){
 			allow_resize = true;
+		} else if(a=="--seed"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing seed value");
+			string v = args[++idx];
+			bool ok = !v.empty() && v.size() <= 20;
+			for(char c: v) if(!isdigit((unsigned char)c)){ ok=false; break; }
+			if(!ok) print_error_and_exit(6, string("Invalid seed: ") + v);
+			errno = 0;
+			unsigned long long sv = strtoull(v.c_str(), nullptr, 10);
+			if(errno == ERANGE) print_error_and_exit(6, string("Invalid seed: ") + v);
+			seed_value = sv;
+			seed_given = true;
+		} else if(a=="--layout"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing layout name");
+			string v = args[++idx];
+			size_t k = 0;
+			while(k < KEYBOARD_LAYOUTS && v != keyboard_geometries[k].name) ++k;
+			if(k == KEYBOARD_LAYOUTS){
+				print_error_and_exit(6, string("Unknown layout: ") + v + " (use qwerty, qwertz, azerty, dvorak or pl)");
+			}
+			keyboard = &keyboard_layouts[k];
+		} else if(a=="--duration"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing duration");
+			string v = args[++idx];
+			char *end = nullptr;
+			errno = 0;
+			double secs = strtod(v.c_str(), &end);
+			if(v.empty() || *end != '\0' || errno == ERANGE || !(secs > 0) || secs > 1e6){
+				print_error_and_exit(6, string("Invalid duration (seconds): ") + v);
+			}
+			duration_ns = (long long)(secs * 1e9);
+		} else if(a=="--fps"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing fps parameter");
+			string v = args[++idx];
+			bool ok = !v.empty() && v.size() <= 4;
+			for(char c: v) if(!isdigit((unsigned char)c)){ ok=false; break; }
+			if(!ok || stoi(v) < 1 || stoi(v) > 1000){
+				print_error_and_exit(6, string("Invalid fps parameter (1-1000): ") + v);
+			}
+			fps_cap = stoi(v);
+		} else if(a=="-j" || a=="--jobs"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing jobs parameter");
+			string v = args[++idx];
+			bool ok = !v.empty() && v.size() <= 3;
+			for(char c: v) if(!isdigit((unsigned char)c)){ ok=false; break; }
+			if(!ok || stoi(v) < 1 || stoi(v) > 256){
+				print_error_and_exit(6, string("Invalid jobs parameter (1-256): ") + v);
+			}
+			jobs = stoi(v);
+		} else if(a=="--from-line" || a=="--to-line"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing line number for " + a);
+			uint64_t n = parse_count(args[++idx]);
+			if(n == 0) print_error_and_exit(6, "Invalid line number for " + a + ": " + args[idx]);
+			(a=="--from-line" ? from_line : to_line) = n;
+		} else if(a=="--lines"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing line range (A:B)");
+			string v = args[++idx];
+			size_t colon = v.find(':');
+			if(colon == string::npos) print_error_and_exit(6, string("Invalid line range (A:B): ") + v);
+			string lo = v.substr(0, colon), hi = v.substr(colon + 1);
+			from_line = lo.empty() ? 1 : parse_count(lo);
+			to_line = hi.empty() ? 0 : parse_count(hi);
+			if(from_line == 0 || (!hi.empty() && to_line == 0)){
+				print_error_and_exit(6, string("Invalid line range (A:B): ") + v);
+			}
+		} else if(a=="--binary-window"){
+			if(idx+1>=args.size()) print_error_and_exit(6, "Missing binary window size");
+			string v = args[++idx];
+			if(v == "all"){
+				binary_window = 0;
+			} else {
+				int shift = 0;
+				char unit = v.empty() ? '\0' : (char)tolower((unsigned char)v.back());
+				if(unit == 'k') shift = 10;
+				else if(unit == 'm') shift = 20;
+				else if(unit == 'g') shift = 30;
+				string digits = shift ? v.substr(0, v.size() - 1) : v;
+				uint64_t n = parse_count(digits);
+				if(n == 0 || n > (UINT64_MAX >> 30)) print_error_and_exit(6, string("Invalid binary window (bytes, k/m/g suffix or all): ") + v);
+				binary_window = n << shift;
+			}
+		} else if(a=="--index"){
+			keep_index = true;
+		} else if(a=="-f" || a=="--follow"){
+			follow_file = true;
+		} else if(a=="--follow-new"){
+			follow_file = follow_from_end = true;
+		} else if(a=="--virtual-clock"){
+			virtual_clock = true;
+		} else if(a=="--estimate"){
+			virtual_clock = true;
+			estimate_only = true;
 		} else if(a=="--debug"){
 			debug_enabled = true;
 		} else if(a=="-h" || a=="--help"){
@@ -835,24 +3030,41 @@ int main(int argc, char **argv){
 		}
 	}
 
+	if(to_line > 0 && to_line < from_line){
+		print_error_and_exit(6, "Line range ends before it starts: " + to_string(from_line) + ":" + to_string(to_line));
+	}
+
+	if(!virtual_clock && (!isatty(STDOUT_FILENO) || !isatty(STDERR_FILENO))){
+		print_error_and_exit(1, "Output cannot be piped or redirected. (FD: 1/2)");
+	}
+
+	rng_seed(seed_given ? seed_value : (uint64_t)chrono::high_resolution_clock::now().time_since_epoch().count());
+	if(fps_cap > 0) frame_pacer_init(fps_cap);
+
 	if(escapes && print_escapes){
 		print_error_and_exit(6, "Options -c/--color and -e/--print-escapes are mutually exclusive");
 	}
 
 	if(!isatty(STDIN_FILENO) && texts.empty() && file_input.empty()){
 		stdin_mode = true;
-		ostringstream buf;
-		buf << cin.rdbuf();
-		string raw_in = buf.str();
-		if(looks_binary(raw_in) && !show_all){
-			print_error_and_exit(4, "Input appears to be binary. Use -a/--show-all to force display.");
-		}
-		input_is_binary = looks_binary(raw_in);
-		istringstream iss(raw_in);
-		string line;
-		while(getline(iss, line)) texts.push_back(line);
 	}
 
+	if(follow_file && file_input.empty()){
+		print_error_and_exit(6, "-f/--follow needs a file (for streams, pipes already type as data arrives)");
+	}
+	if(follow_file && duration_ns > 0){
+		print_error_and_exit(6, "--duration cannot be combined with -f/--follow (the input never ends)");
+	}
+
+	if(duration_ns > 0 && (stdin_mode || file_input.empty()) && texts.empty()){
+		print_error_and_exit(6, "--duration needs a file or -t/--text input (streams cannot be pre-scanned)");
+	}
+
+	file_source src;
+	bool have_file = false;
+	int total_lines = (int)texts.size();
+	bool total_known = true;
+
 	if(!file_input.empty()){
 		if(access(file_input.c_str(), F_OK) != 0){
 			print_error_and_exit(8, string("File does not exist: ") + file_input);
@@ -860,120 +3072,121 @@ int main(int argc, char **argv){
 		if(access(file_input.c_str(), R_OK) != 0){
 			print_error_and_exit(5, string("Cannot read file (permission denied): ") + file_input);
 		}
-
-		ifstream f(file_input, ios::in | ios::binary);
-		if(!f){
+		if(!file_source_open(src, file_input)){
 			print_error_and_exit(5, string("Cannot open file for reading: ") + file_input);
 		}
-		ostringstream buf;
-		buf << f.rdbuf();
-		string raw_in = buf.str();
 
-		if(raw_in.empty()){
-			print_error_and_exit(9, string("File is empty: ") + file_input);
+		if(follow_file){
+			struct stat st{};
+			if(fstat(src.fd, &st) != 0 || !S_ISREG(st.st_mode)){
+				print_error_and_exit(6, "-f/--follow needs a regular file: " + file_input);
+			}
 		}
 
-		if(looks_binary(raw_in) && !show_all){
-			print_error_and_exit(10, "File appears to be binary. Use -a/--show-all to force display.");
+		// An empty file is fine to follow: it may just have been rotated.
+		string_view window = file_source_window(src, 4096);
+		if(window.empty() && !follow_file){
+			print_error_and_exit(9, string("File is empty: ") + file_input);
+		}
+		have_file = true;
+		if(duration_ns > 0 && !src.map){
+			print_error_and_exit(6, "--duration needs a regular file; this input cannot be read twice: " + file_input);
 		}
-		input_is_binary = looks_binary(raw_in);
-		istringstream iss(raw_in);
-		string line;
-		while(getline(iss, line)) texts.push_back(line);
-	}
 
-	if(!texts.empty()){
-		int total_lines = (int)texts.size();
-		print_hide_cursor();
-		for(int idx = 0; idx < total_lines; ++idx){
-			if(sig_flag){
-				int signo = sig_flag;
-				sig_flag = 0;
-				handle_signal_event(signo);
+		if(follow_file){
+			follow_state fs;
+			off_t start = 0;
+			if(follow_from_end && src.map){
+				// Start after the last complete line; one still being written is
+				// typed whole once it is finished. Earlier lines are only counted.
+				size_t end = src.map_len;
+				while(end > 0 && src.map[end - 1] != '\n') --end;
+				start = (off_t)end;
+				uint64_t want = UINT64_MAX;
+				newline_skip(src.map, (size_t)start, want);
+				fs.first_line = UINT64_MAX - want;
 			}
-			if(line_numbers){
-				type_line(texts[idx], idx+1, total_lines);
-			} else {
-				type_line(texts[idx], -1, 0);
+			file_source_classify(src, (size_t)start, src.map_len);
+			if(src.map){
+				munmap((void *)src.map, src.map_len);
+				src.map = nullptr;
 			}
+			lseek(src.fd, start, SEEK_SET);
+			follow_open(fs, file_input);
+			if(!texts.empty()){
+				print_hide_cursor();
+				type_all_lines(src, false, total_lines, true);
+			}
+			stream_lines(src.fd, false, &fs);
+			if(virtual_clock) print_virtual_summary();
+			if(debug_enabled) print_finish_debug();
+			return 0;
 		}
-		if(debug_enabled){
-			string success_prefix = string("\x1B[32m") + "success (0):" + "\x1B[0m";
-			cout << success_prefix << " " << "work finished successfully! (allow-resize: " << (allow_resize ? "ENABLED" : "DISABLED") << ")" << endl;
-		}
-		return 0;
-	}
-
-	if(isatty(STDIN_FILENO) && file_input.empty()){
-		string partial;
-		int lineno = 0;
-		const int BUF_SIZE = 4096;
-		vector<char> buf(BUF_SIZE);
 
-		while(true){
-			if(sig_flag){
-				int signo = sig_flag;
-				sig_flag = 0;
-				handle_signal_event(signo);
+		line_index ix;
+		if(src.map && (line_numbers || keep_index)){
+			long long t0 = mono_now_ns();
+			string index_path = file_input + ".tcidx";
+			if(!keep_index || !line_index_load(ix, src, index_path)){
+				line_index_build(ix, src.map, src.map_len);
+				if(keep_index) line_index_save(ix, src, index_path);
 			}
-
-			print_show_cursor();
-
-			struct pollfd fds[2]{};
-			fds[0].fd = STDIN_FILENO;
-			fds[0].events = POLLIN;
-			fds[0].revents = 0;
-
-			fds[1].fd = (sig_pipe_fds[0] != -1) ? sig_pipe_fds[0] : -1;
-			fds[1].events = (fds[1].fd != -1) ? POLLIN : 0;
-			fds[1].revents = 0;
-
-			int nfds = (fds[1].fd != -1) ? 2 : 1;
-			int pres = poll(fds, nfds, -1);
-			if(pres < 0){
-				if(errno == EINTR) continue;
-				print_error_and_exit(7, string("poll() failed: ") + strerror(errno));
+			if(debug_enabled){
+				string dbg_prefix = string("\x1B[36m") + "DEBUG:" + "\x1B[0m";
+				cerr << dbg_prefix << " line index " << ix.origin << " lines=" << ix.lines << " marks=" << ix.marks.size()
+					 << " in " << (double)(mono_now_ns() - t0) / 1e6 << "ms" << endl;
 			}
+		}
+		if(from_line > 1 || to_line > 0) file_source_select(src, ix, from_line, to_line);
 
-			if(nfds == 2 && (fds[1].revents & POLLIN)){
-				drain_sig_pipe();
-				if(sig_flag){
-					int signo = sig_flag;
-					sig_flag = 0;
-					handle_signal_event(signo);
-				}
-			}
+		// Only the bytes that will be typed are classified.
+		size_t scan_end = src.map_len;
+		if(src.map && to_line > 0){
+			uint64_t want = to_line - src.line_no;
+			scan_end = src.pos + newline_skip(src.map + src.pos, src.map_len - src.pos, want);
+		}
+		file_source_classify(src, src.pos, scan_end);
 
-			if(fds[0].revents & (POLLIN|POLLERR|POLLHUP)){
-				ssize_t r = read(STDIN_FILENO, buf.data(), BUF_SIZE);
-				if(r < 0){
-					if(errno == EINTR) continue;
-					print_error_and_exit(7, string("read() failed: ") + strerror(errno));
-				}
-				if(r == 0){
-					break;
-				}
-				partial.append(buf.data(), buf.data() + r);
-				size_t pos;
-				while((pos = partial.find('\n')) != string::npos){
-					string line = partial.substr(0, pos);
-					if(!line.empty() && line.back() == '\r') line.pop_back();
-					partial.erase(0, pos + 1);
-
-					print_hide_cursor();
-					++lineno;
-					if(line_numbers){
-						type_line(line, lineno, lineno);
-					} else {
-						type_line(line, -1, 0);
-					}
-				}
-			}
+		if(line_numbers){
+			if(src.map) total_lines += (int)(to_line > 0 ? min(ix.lines, to_line) : ix.lines);
+			else total_known = false;
 		}
-		if(debug_enabled){
-			string success_prefix = string("\x1B[32m") + "success (0):" + "\x1B[0m";
-			cout << success_prefix << " " << "work finished successfully! (allow-resize: " << (allow_resize ? "ENABLED" : "DISABLED") << ")" << endl;
+	}
+
+	if(!texts.empty() || have_file){
+		if(duration_ns > 0){
+			// Dry run on the virtual clock with the same seed: it draws exactly the
+			// delays the real run will draw, so their total weight is known upfront.
+			bool saved_virtual = virtual_clock, saved_estimate = estimate_only, saved_debug = debug_enabled;
+			virtual_clock = estimate_only = true;
+			debug_enabled = false;
+			type_all_lines(src, have_file, total_lines, total_known);
+			long long weight = tclock.weight_sum;
+			virtual_clock = saved_virtual;
+			estimate_only = saved_estimate;
+			debug_enabled = saved_debug;
+
+			file_source_rewind(src);
+			typing_clock_reset();
+			out_stats = output_stats();
+			pacer = frame_pacer();
+			if(fps_cap > 0) frame_pacer_init(fps_cap);
+			rng_seed(rng.seed);
+			tclock.budget_ns = duration_ns;
+			tclock.budget_weight = weight;
 		}
+		print_hide_cursor();
+		type_all_lines(src, have_file, total_lines, total_known);
+		file_source_close(src);
+		if(virtual_clock) print_virtual_summary();
+		if(debug_enabled) print_finish_debug();
+		return 0;
+	}
+
+	if(stdin_mode || (isatty(STDIN_FILENO) && file_input.empty())){
+		stream_lines(STDIN_FILENO, !stdin_mode);
+		if(virtual_clock) print_virtual_summary();
+		if(debug_enabled) print_finish_debug();
 	}
 	return 0;
 }
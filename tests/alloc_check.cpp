@@ -0,0 +1,94 @@
+// Allocation check: counts operator new calls while lines are walked with
+// glyph_cursor and while they go through the whole render path (normalize,
+// plan, type_line under --estimate), after one warm-up pass has sized the
+// reused buffers. Both must stay at zero allocations per glyph.
+//
+// build: g++ -std=c++17 -O2 -pthread tests/alloc_check.cpp -o alloc_check
+// usage: ./alloc_check [passes]
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long long> heap_allocs{0};
+
+void *operator new(std::size_t n){
+	heap_allocs.fetch_add(1, std::memory_order_relaxed);
+	if(void *p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void *operator new[](std::size_t n){ return operator new(n); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+#define main typecat_main
+#include "../main.cpp"
+#undef main
+
+// ASCII, Latin with combining marks, CJK, emoji, tabs, escapes and an
+// invalid byte.
+static const char *const sample_lines[] = {
+	"plain ASCII text that takes the fast path through the cursor",
+	"zaz\xcc\x87o\xcc\x81\xc5\x82\xc4\x87 g\xc4\x99\xc5\x9bl\xc4\x85 ja\xc5\xba\xc5\x84 caf\xc3\xa9 e\xcc\x81t\xc3\xa9",
+	"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x83\x86\xe3\x82\xad\xe3\x82\xb9\xe3\x83\x88 \xed\x95\x9c\xea\xb5\xad\xec\x96\xb4",
+	"emoji \xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd \xf0\x9f\x8e\x89\t\xf0\x9f\x9a\x80 and a tab\tor two",
+	"\x1b[1;31mred\x1b[0m and \x1b[38;5;208morange\x1b[0m with a stray \xff byte",
+	"a long line to force wrapping: lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore",
+};
+
+int main(int argc, char **argv){
+	int passes = argc > 1 ? atoi(argv[1]) : 200;
+	virtual_clock = true;
+	estimate_only = true;
+	escapes = true;
+	mistakes = true;
+	rng_seed(8);
+
+	vector<string> raw(begin(sample_lines), end(sample_lines));
+	string text;
+	line_plan plan;
+
+	// Warm-up: sizes text, the plan arrays and the frame buffer.
+	for(const string &r : raw){
+		normalize_line(r, text);
+		plan_line(plan, text);
+		type_line(text, plan, 0, 0);
+	}
+
+	// The counter has to see a plain heap allocation, or the zeros below mean
+	// nothing.
+	unsigned long long before = heap_allocs.load();
+	volatile size_t probe_len = 64;
+	string probe(probe_len, 'x');
+	if(heap_allocs.load() == before || probe.size() != probe_len){
+		printf("operator new is not being counted\n");
+		return 2;
+	}
+
+	unsigned long long glyphs = 0;
+	before = heap_allocs.load();
+	for(int k = 0; k < passes; ++k){
+		for(const string &r : raw){
+			glyph_cursor gc{r};
+			while(!gc.done()){ gc.next(); ++glyphs; }
+		}
+	}
+	unsigned long long cursor_allocs = heap_allocs.load() - before;
+	printf("glyph_cursor: %llu glyphs, %llu allocations\n", glyphs, cursor_allocs);
+
+	unsigned long long typed = out_stats.glyphs;
+	before = heap_allocs.load();
+	for(int k = 0; k < passes; ++k){
+		for(const string &r : raw){
+			normalize_line(r, text);
+			plan_line(plan, text);
+			type_line(text, plan, 0, 0);
+		}
+	}
+	unsigned long long render_allocs = heap_allocs.load() - before;
+	typed = out_stats.glyphs - typed;
+	printf("render path:  %llu glyphs, %llu allocations (%.4f per glyph)\n", typed, render_allocs,
+		(double)render_allocs / (double)(typed ? typed : 1));
+	return cursor_allocs == 0 && render_allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# -j/--jobs benchmark: writes a fixed corpus (long lines, ANSI colors, wide
+# and combining characters, about 40 MB) and times `--estimate -c -j N` over
+# it for each N. The estimate must not depend on N, so it is compared too.
+#
+# usage: tests/bench_jobs.py [path/to/typecat] [--lines N] [--runs N] [--jobs 1,2,4,8]
+import os, random, statistics, subprocess, sys, tempfile, time
+
+binary = "./typecat"
+lines = 300000
+runs = 5
+jobs = None
+args = sys.argv[1:]
+while args:
+	a = args.pop(0)
+	if a == "--lines":
+		lines = int(args.pop(0))
+	elif a == "--runs":
+		runs = int(args.pop(0))
+	elif a == "--jobs":
+		jobs = [int(j) for j in args.pop(0).split(",")]
+	else:
+		binary = a
+if jobs is None:
+	cpus = os.cpu_count() or 1
+	jobs = [j for j in (1, 2, 4, 8, 16) if j <= max(cpus, 2)]
+
+WORDS = ["typing", "terminal", "glyph", "render", "latency", "buffer", "cursor",
+	"zażółć", "gęślą", "jaźń", "日本語", "テキスト", "한국어", "été", "👍🏽", "a‍b"]
+COLORS = ["\x1b[31m", "\x1b[32m", "\x1b[1;34m", "\x1b[38;5;208m", "\x1b[0m"]
+
+def write_corpus(path):
+	# Fixed seed: every run and every machine gets the same bytes.
+	rnd = random.Random(21)
+	with open(path, "w", encoding="utf-8") as f:
+		for _ in range(lines):
+			parts = []
+			for _ in range(rnd.randint(4, 24)):
+				if rnd.random() < 0.15:
+					parts.append(rnd.choice(COLORS))
+				parts.append(rnd.choice(WORDS))
+			f.write(" ".join(parts) + "\x1b[0m\n")
+
+def time_run(corpus, j):
+	start = time.monotonic()
+	out = subprocess.run([binary, "--estimate", "-c", "--seed", "1", "-j", str(j), corpus],
+		stdout=subprocess.PIPE, stderr=subprocess.STDOUT, check=True).stdout
+	return time.monotonic() - start, out
+
+def main():
+	if not os.access(binary, os.X_OK):
+		print("typecat binary not found: %s" % binary, file=sys.stderr)
+		return 2
+	with tempfile.TemporaryDirectory() as tmp:
+		corpus = os.path.join(tmp, "corpus.txt")
+		write_corpus(corpus)
+		print("corpus: %d lines, %.1f MB; cpus: %d; runs per -j: %d" % (lines,
+			os.path.getsize(corpus) / 1e6, os.cpu_count() or 1, runs))
+		base = None
+		estimate = None
+		for j in jobs:
+			time_run(corpus, j)  # warm the page cache
+			times = []
+			for _ in range(runs):
+				t, out = time_run(corpus, j)
+				times.append(t)
+				if estimate is None:
+					estimate = out
+				elif out != estimate:
+					print("-j %d changed the estimate: %r vs %r" % (j, out, estimate), file=sys.stderr)
+					return 1
+			med = statistics.median(times)
+			base = base or med
+			print("-j %-3d median %.3fs  min %.3fs  speedup %.2fx" % (j, med, min(times), base / med))
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Headless output check: --virtual-clock output piped into a reader that
+# quits early (head) must not kill typecat with SIGPIPE; the run finishes and
+# prints the same summary as a run whose output is read to the end.
+#
+# usage: tests/pipe_check.py [path/to/typecat]
+import os, subprocess, sys, tempfile
+
+binary = sys.argv[1] if len(sys.argv) > 1 else "./typecat"
+
+def run(path, reader):
+	typecat = subprocess.Popen([binary, "--virtual-clock", "--seed", "1", "-s", "100", path],
+		stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+	head = subprocess.Popen(reader, stdin=typecat.stdout, stdout=subprocess.DEVNULL)
+	typecat.stdout.close()
+	err = typecat.stderr.read().decode()
+	typecat.wait()
+	head.wait()
+	return typecat.returncode, err
+
+def duration(summary):
+	for word in summary.split():
+		if word.startswith("duration="):
+			return word
+	return None
+
+def main():
+	if not os.access(binary, os.X_OK):
+		print("typecat binary not found: %s" % binary, file=sys.stderr)
+		return 2
+	with tempfile.TemporaryDirectory() as tmp:
+		path = os.path.join(tmp, "input.txt")
+		with open(path, "w") as f:
+			for i in range(5000):
+				f.write("line %d of a file that is piped into a reader which quits early\n" % i)
+		full_code, full_err = run(path, ["cat"])
+		code, err = run(path, ["head", "-c", "10"])
+	problems = []
+	if full_code != 0:
+		problems.append("| cat: exit %d" % full_code)
+	if code != 0:
+		problems.append("| head: exit %d, want 0" % code)
+	if duration(err) is None or duration(err) != duration(full_err):
+		problems.append("| head summary %r, want %r" % (err.strip(), full_err.strip()))
+	print("%-4s --virtual-clock | head -c 10  exit=%d %s" % ("FAIL" if problems else "ok", code, duration(err)))
+	for p in problems:
+		print("     " + p)
+	return 1 if problems else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# Render check: types small inputs in a pty, replays the output through a
+# minimal terminal model and compares the final screen with the input text.
+#
+# usage: tests/render_check.py [path/to/typecat]
+import os, pty, re, select, struct, sys, tempfile, termios, fcntl, unicodedata
+
+binary = sys.argv[1] if len(sys.argv) > 1 else "./typecat"
+
+def run(args, cols):
+	pid, fd = pty.fork()
+	if pid == 0:
+		fcntl.ioctl(0, termios.TIOCSWINSZ, struct.pack("HHHH", 24, cols, 0, 0))
+		os.execv(binary, [binary, "-s", "100", "--seed", "1"] + args)
+	out = b""
+	while True:
+		r, _, _ = select.select([fd], [], [], 10)
+		if not r:
+			break
+		try:
+			d = os.read(fd, 65536)
+		except OSError:
+			break
+		if not d:
+			break
+		out += d
+	_, status = os.waitpid(pid, 0)
+	os.close(fd)
+	return os.waitstatus_to_exitcode(status), out
+
+def width(ch):
+	if unicodedata.combining(ch) or ch in "\u200d\ufe0f":
+		return 0
+	return 2 if unicodedata.east_asian_width(ch) in "WF" else 1
+
+# Just enough of a terminal for typecat's output: CR/LF, CHA, EL, ED and
+# autowrap with a pending-wrap column. The pty turns '\n' into "\r\n".
+def screen(data, cols):
+	text = data.decode("utf-8", "replace")
+	rows = [[" "] * cols]
+	r = c = 0
+	pend = False
+	i = 0
+	while i < len(text):
+		ch = text[i]
+		if ch == "\x1b":
+			m = re.match(r"\x1b\[([?0-9;]*)([@-~])", text[i:])
+			if not m:
+				i += 2
+				continue
+			i += m.end()
+			p, f = m.group(1), m.group(2)
+			if f == "K" or f == "J":
+				rows[r][c:] = [" "] * (cols - c)
+				if f == "J":
+					del rows[r + 1:]
+			elif f == "G":
+				c = min(cols - 1, max(0, int(p or 1) - 1))
+			pend = False
+			continue
+		i += 1
+		if ch == "\r":
+			c = 0
+			pend = False
+		elif ch == "\n":
+			r += 1
+			pend = False
+		elif ch >= " ":
+			w = width(ch)
+			if w == 0:
+				# Joins the cell just written.
+				k = c if pend else c - 1
+				while k > 0 and rows[r][k] == "":
+					k -= 1
+				if k >= 0:
+					rows[r][k] += ch
+				continue
+			if pend or c + w > cols:
+				r += 1
+				c = 0
+				pend = False
+			while len(rows) <= r:
+				rows.append([" "] * cols)
+			rows[r][c] = ch
+			if w == 2 and c + 1 < cols:
+				rows[r][c + 1] = ""
+			c += w
+			if c >= cols:
+				c = cols - 1
+				pend = True
+		while len(rows) <= r:
+			rows.append([" "] * cols)
+	lines = ["".join(row).rstrip() for row in rows]
+	return [unicodedata.normalize("NFC", l) for l in lines if l]
+
+# (name, file contents, extra options, columns, expected screen rows)
+CASES = [
+	("CRLF", b"hello\r\nworld\r\n", [], 40, ["hello", "world"]),
+	("CRLF with typos", b"hello\r\nworld\r\n", ["-m", "100"], 40, ["hello", "world"]),
+	("CRLF wrapped", b"abcdefgh\r\n", [], 6, ["abcde", "fgh"]),
+	("C0 controls", b"a\x01b\x7fc\rd\n", ["-m", "100"], 40, ["abcd"]),
+	("combining marks", "e\u0301e\u0301e\u0301x\n".encode(), [], 40, ["\u00e9\u00e9\u00e9x"]),
+	("wide glyphs", "日本語テキスト\n".encode(), [], 9, ["日本語テ", "キスト"]),
+]
+
+def main():
+	if not os.access(binary, os.X_OK):
+		print("typecat binary not found: %s" % binary, file=sys.stderr)
+		return 2
+	failed = 0
+	with tempfile.TemporaryDirectory() as tmp:
+		for name, data, opts, cols, want in CASES:
+			path = os.path.join(tmp, "input.txt")
+			with open(path, "wb") as f:
+				f.write(data)
+			code, out = run(opts + [path], cols)
+			got = screen(out, cols)
+			want = [unicodedata.normalize("NFC", l) for l in want]
+			ok = code == 0 and got == want
+			print("%-4s %-18s exit=%d%s" % ("ok" if ok else "FAIL", name, code,
+				"" if ok else " screen=%r want=%r" % (got, want)))
+			failed += not ok
+	return 1 if failed else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# Signal latency check: runs typecat in a pty, sends a signal while it is
+# sleeping between glyphs and checks the exit code, that the cursor was shown
+# again, and how long it took to exit.
+#
+# usage: tests/signal_latency.py [path/to/typecat] [--max-ms N]
+import os, pty, select, signal, sys, time
+
+binary = "./typecat"
+max_ms = 20.0
+args = sys.argv[1:]
+while args:
+	a = args.pop(0)
+	if a == "--max-ms":
+		max_ms = float(args.pop(0))
+	else:
+		binary = a
+
+TEXT = "signals should end a typing sleep at once " * 20
+
+# (name, signal, expected exit code, extra options)
+CASES = [
+	("SIGINT", signal.SIGINT, 130, []),
+	("SIGTERM", signal.SIGTERM, 143, []),
+	("SIGQUIT", signal.SIGQUIT, 131, []),
+	("SIGHUP", signal.SIGHUP, 129, []),
+	("SIGWINCH", signal.SIGWINCH, 128 + signal.SIGWINCH, []),
+	("SIGINT --fps 10", signal.SIGINT, 130, ["--fps", "10"]),
+	("SIGINT --duration 60", signal.SIGINT, 130, ["--duration", "60"]),
+]
+
+def run(sig, opts, after=0.3, timeout=10.0):
+	pid, fd = pty.fork()
+	if pid == 0:
+		os.execv(binary, [binary, "-s", "1"] + opts + ["-t", TEXT])
+	out = b""
+	start = time.monotonic()
+	sent = None
+	while True:
+		now = time.monotonic()
+		if sent is None and now - start >= after:
+			os.kill(pid, sig)
+			sent = now
+		if now - start > timeout:
+			os.kill(pid, signal.SIGKILL)
+			break
+		r, _, _ = select.select([fd], [], [], 0.002)
+		if r:
+			try:
+				d = os.read(fd, 65536)
+			except OSError:
+				break
+			if not d:
+				break
+			out += d
+	end = time.monotonic()
+	_, status = os.waitpid(pid, 0)
+	os.close(fd)
+	latency = (end - sent) * 1000 if sent is not None else float("inf")
+	return os.waitstatus_to_exitcode(status), latency, out
+
+def main():
+	if not os.access(binary, os.X_OK):
+		print("typecat binary not found: %s" % binary, file=sys.stderr)
+		return 2
+	failed = 0
+	for name, sig, want, opts in CASES:
+		code, latency, out = run(sig, opts)
+		problems = []
+		if code != want:
+			problems.append("exit %d, want %d" % (code, want))
+		if latency > max_ms:
+			problems.append("latency %.1fms over %.0fms" % (latency, max_ms))
+		if out.rfind(b"\x1b[?25h") < out.rfind(b"\x1b[?25l"):
+			problems.append("cursor left hidden")
+		print("%-4s %-22s exit=%d latency=%.2fms%s" % ("FAIL" if problems else "ok", name, code, latency,
+			(" (" + "; ".join(problems) + ")") if problems else ""))
+		failed += bool(problems)
+	return 1 if failed else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,84 @@
+// Width lookup microbenchmark: the compile-time page table against a linear
+// interval scan (how unicode_wcwidth() used to work), both over the old
+// short lists and over the complete lists the table is built from. The input
+// is a CJK, emoji, Latin and combining mix. Also checks that the table and the
+// scan of the complete lists agree on every code point.
+//
+// build: g++ -std=c++17 -O2 -pthread tests/width_bench.cpp -o width_bench
+// usage: ./width_bench [lookups]
+#define main typecat_main
+#include "../main.cpp"
+#undef main
+
+static bool in_intervals(const unicode_interval *iv, size_t n, uint32_t cp){
+	for(size_t k = 0; k < n; ++k){
+		if(cp >= iv[k].first && cp <= iv[k].last) return true;
+	}
+	return false;
+}
+
+// The lists unicode_wcwidth() scanned before the page table.
+static const unicode_interval old_combining[] = {
+	{0x0300, 0x036F}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x20D0, 0x20FF}, {0xFE20, 0xFE2F}
+};
+static const unicode_interval old_wide[] = {
+	{0x1100, 0x115F}, {0x2329, 0x232A}, {0x2E80, 0xA4CF}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+	{0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+};
+
+static int old_wcwidth(uint32_t ucs){
+	if(ucs < 32 || (ucs >= 0x7F && ucs < 0xA0)) return 0;
+	if(in_intervals(old_combining, sizeof(old_combining)/sizeof(old_combining[0]), ucs)) return 0;
+	if(in_intervals(old_wide, sizeof(old_wide)/sizeof(old_wide[0]), ucs)) return 2;
+	return 1;
+}
+
+static int scan_wcwidth(uint32_t ucs){
+	if(ucs < 32 || (ucs >= 0x7F && ucs < 0xA0)) return 0;
+	if(in_intervals(zero_width_intervals, sizeof(zero_width_intervals)/sizeof(zero_width_intervals[0]), ucs)) return 0;
+	if(in_intervals(wide_intervals, sizeof(wide_intervals)/sizeof(wide_intervals[0]), ucs)) return 2;
+	return 1;
+}
+
+template<class F>
+static double ns_per_lookup(const vector<uint32_t> &cps, size_t lookups, F width, long long &sum){
+	long long t0 = mono_now_ns();
+	for(size_t k = 0; k < lookups; ++k) sum += width(cps[k % cps.size()]);
+	return (double)(mono_now_ns() - t0) / (double)lookups;
+}
+
+int main(int argc, char **argv){
+	size_t lookups = argc > 1 ? (size_t)atoll(argv[1]) : 20000000;
+
+	size_t mismatches = 0;
+	for(uint32_t cp = 0; cp < 0x110000; ++cp){
+		if(unicode_wcwidth(cp) != scan_wcwidth(cp)){
+			if(mismatches++ < 10) printf("mismatch U+%04X: table %d, scan %d\n", cp, unicode_wcwidth(cp), scan_wcwidth(cp));
+		}
+	}
+
+	// A quarter each: CJK ideographs, emoji, Latin-1/Extended letters and
+	// combining marks, shuffled so the branch predictor cannot follow along.
+	vector<uint32_t> cps;
+	rng_seed(10);
+	for(int k = 0; k < 4096; ++k){
+		switch(k & 3){
+			case 0: cps.push_back(0x4E00 + rng_below(0x5000)); break;
+			case 1: cps.push_back(0x1F300 + rng_below(0x300)); break;
+			case 2: cps.push_back(0x00C0 + rng_below(0x180)); break;
+			default: cps.push_back(0x0300 + rng_below(0x70)); break;
+		}
+	}
+	for(size_t k = cps.size() - 1; k > 0; --k) swap(cps[k], cps[rng_below((uint32_t)k + 1)]);
+
+	long long sum = 0;
+	double old_scan = ns_per_lookup(cps, lookups, old_wcwidth, sum);
+	double scan = ns_per_lookup(cps, lookups, scan_wcwidth, sum);
+	double table = ns_per_lookup(cps, lookups, unicode_wcwidth, sum);
+	printf("%zu lookups (ns/lookup):\n", lookups);
+	printf("  interval scan, old lists       %7.2f\n", old_scan);
+	printf("  interval scan, complete lists  %7.2f\n", scan);
+	printf("  page table                     %7.2f\n", table);
+	printf("mismatches %zu, checksum %lld\n", mismatches, sum);
+	return mismatches == 0 ? 0 : 1;
+}